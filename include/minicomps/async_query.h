@@ -10,6 +10,8 @@
 #include <minicomps/component.h>
 #include <minicoros/coroutine.h>
 
+#include <algorithm>
+#include <chrono>
 #include <tuple>
 #include <memory>
 #include <utility>
@@ -63,7 +65,7 @@ public:
       {}
 
     ~query_invoker() {
-      async_query_.execute(std::move(callback_), std::move(lifetime_), std::move(arguments_));
+      async_query_.execute(std::move(callback_), std::move(lifetime_), deadline_, std::move(arguments_));
     }
 
     query_invoker&& with_lifetime(const lifetime& life) && {
@@ -71,6 +73,17 @@ public:
       return std::move(*this);
     }
 
+    /// If the request is still queued when `deadline` passes, the query fails with `query_error::timed_out`
+    /// instead of invoking the handler. Doesn't apply when the query is invoked synchronously.
+    query_invoker&& with_deadline(std::chrono::steady_clock::time_point deadline) && {
+      deadline_ = deadline;
+      return std::move(*this);
+    }
+
+    query_invoker&& with_timeout(std::chrono::steady_clock::duration timeout) && {
+      return std::move(*this).with_deadline(std::chrono::steady_clock::now() + timeout);
+    }
+
     query_invoker&& with_callback(std::function<void(mc::concrete_result<return_type>&&)>&& callback) && {
       callback_ = std::move(callback);
       return std::move(*this);
@@ -93,6 +106,7 @@ public:
   private:
     async_query& async_query_;
     lifetime_weak_ptr lifetime_;
+    std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max();
     std::function<void(mc::concrete_result<return_type>&&)> callback_;
     std::tuple<ArgumentTypes...> arguments_;
     component* sender_;
@@ -124,7 +138,7 @@ public:
 
 private:
   template<typename CallbackType, typename... ArgumentTypes>
-  void execute(CallbackType callback, lifetime_weak_ptr&& lifetime, std::tuple<ArgumentTypes...>&& arguments) {
+  void execute(CallbackType callback, lifetime_weak_ptr&& lifetime, std::chrono::steady_clock::time_point deadline, std::tuple<ArgumentTypes...>&& arguments) {
     auto handler = handler_->lookup();
     auto& receiving_component = handler_->receiver();
 
@@ -146,17 +160,53 @@ private:
         std::function<void(mc::concrete_result<return_type>&&)> callback;
         executor_ptr receiver_executor; // We have to capture executor as a shared_ptr to protect against lifetime issues
         lifetime_weak_ptr lifetime;
+        std::chrono::steady_clock::time_point deadline;
 
         // Fields used only for the listener
         component* receiver;
         component* sender;
+
+        /// Lets the executor throw the request away without running it once the caller has gone away
+        bool canceled() const {
+          return lifetime.expired();
+        }
       };
 
-      request_data request{std::move(arguments), std::move(callback), owning_component_->default_executor, std::move(lifetime), owning_component_, receiving_component.get()};
+      // Responses to requests in a lane above the response lane stay in that lane
+      const lane request_lane = handler_->receiver_lane();
+      const lane response_lane = std::min(request_lane, lane::RESPONSE);
+
+      if (!handler_->receiver_executor()->admit(work_kind::REQUEST)) {
+        // The receiver is overloaded. The failure is delivered like any other response, so the callback never runs
+        // before the call returns.
+        callback_result<return_type> result_handler{
+          executor_ptr(owning_component_->default_executor),
+          std::move(lifetime),
+          owning_component_,
+          receiving_component.get(),
+          msg_info_,
+          std::move(callback),
+          response_lane
+        };
+
+        result_handler(mc::failure(query_error::overloaded));
+        return;
+      }
+
+      request_data request{std::move(arguments), std::move(callback), owning_component_->default_executor, std::move(lifetime), deadline, owning_component_, receiving_component.get()};
 
       // Note: handler as captured here could become a dangling pointer if the message handler is removed/replaced
-      auto request_task = [handler] (void* data) {
+      // The response lane is captured rather than stored in request_data, which keeps the request within the task's inline storage
+      auto request_task = [handler, response_lane] (void* data) {
         request_data& request = *static_cast<request_data*>(data);
+
+        if (request.canceled()) {
+          if (executor* current = executor::current())
+            current->count_canceled_request();
+
+          return;
+        }
+
         const message_info& msg_info = get_message_info(static_cast<MessageType*>(nullptr));
 
         // The callback_result is the object that gets called by the application to return a value to the calling component. Sender and receiver
@@ -167,13 +217,20 @@ private:
           request.receiver,
           request.sender,
           msg_info,
-          std::move(request.callback)
+          std::move(request.callback),
+          response_lane
         };
 
+        // Nobody is waiting for the response anymore, so the handler doesn't get to run
+        if (request_expired(request.deadline)) {
+          result_handler(mc::failure(query_error::timed_out));
+          return;
+        }
+
         std::apply(*handler, std::tuple_cat(std::move(request.arguments), std::make_tuple(std::move(result_handler))));
       };
 
-      handler_->receiver_executor()->enqueue_work(std::move(request_task), std::move(request));
+      handler_->receiver_executor()->enqueue_work(std::move(request_task), std::move(request), request_lane);
 
       if (receiving_component->listener)
         receiving_component->listener->on_enqueue(owning_component_, receiving_component.get(), msg_info_, message_type::REQUEST);
@@ -0,0 +1,128 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_BLOCKING_POOL_H_
+#define MINICOMPS_BLOCKING_POOL_H_
+
+#include <minicomps/callback.h>
+#include <minicomps/messaging.h>
+#include <minicomps/task.h>
+#include <minicomps/task_pool.h>
+#include <minicomps/task_ring.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mc {
+
+/// Shows up in listener callbacks for results of blocking jobs
+inline const message_info blocking_job_info{"blocking_job", 0};
+
+/// Runs blocking calls (file I/O, name lookups, ...) on a fixed set of worker threads, so they don't stall the
+/// caller's executor and every other component on it. Results are passed to a callback_result, which enqueues them
+/// on the caller's executor and drops them if the caller's lifetime has ended by then.
+///
+/// At most `max_queued` jobs wait for a worker; jobs beyond that fail right away with `query_error::overloaded`.
+/// Jobs whose caller has gone away by the time a worker gets to them are skipped. Jobs that haven't started when
+/// the pool is destroyed are dropped without a result.
+class blocking_pool {
+public:
+  explicit blocking_pool(std::size_t num_workers, std::size_t max_queued = 1024);
+  ~blocking_pool();
+
+  blocking_pool(const blocking_pool&) = delete;
+  blocking_pool& operator =(const blocking_pool&) = delete;
+
+  /// Runs `job()` on a worker and passes what it returns to `result`. The job can return a value, a
+  /// `mc::concrete_result<R>` or a `mc::failure`, or nothing if R is void. Handlers of async queries can pass
+  /// their callback_result straight through, so the response goes to the original caller. Results of direct calls
+  /// are enqueued on the caller's executor too, rather than resolved on the worker.
+  template<typename R, typename JobType>
+  void submit(JobType job, callback_result<R>&& result) {
+    result.enqueue_on_caller();
+
+    struct job_data {
+      JobType job;
+      callback_result<R> result;
+      blocking_pool* pool;
+    };
+
+    auto run_job = [] (void* data) {
+      job_data& current = *static_cast<job_data*>(data);
+
+      if (current.result.canceled()) {
+        current.pool->num_canceled_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+
+      // Counted before the result is passed on, so the caller never sees the result before the count
+      if constexpr (std::is_void_v<std::invoke_result_t<JobType&>>) {
+        current.job();
+        current.pool->num_completed_.fetch_add(1, std::memory_order_relaxed);
+        current.result({});
+      }
+      else {
+        auto value = current.job();
+        current.pool->num_completed_.fetch_add(1, std::memory_order_relaxed);
+        current.result(std::move(value));
+      }
+    };
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      if (jobs_.size() < max_queued_) {
+        jobs_.emplace_back(run_job, job_data{std::move(job), std::move(result), this}, &task_pool_);
+        work_available_.notify_one();
+        return;
+      }
+    }
+
+    num_rejected_.fetch_add(1, std::memory_order_relaxed);
+    result(mc::failure(query_error::overloaded));
+  }
+
+  std::size_t num_workers() const {
+    return workers_.size();
+  }
+
+  /// Jobs that ran and passed on their result
+  std::uint64_t num_completed_jobs() const {
+    return num_completed_.load(std::memory_order_relaxed);
+  }
+
+  /// Jobs that were skipped because the caller had gone away
+  std::uint64_t num_canceled_jobs() const {
+    return num_canceled_.load(std::memory_order_relaxed);
+  }
+
+  /// Jobs that failed because too many were waiting for a worker
+  std::uint64_t num_rejected_jobs() const {
+    return num_rejected_.load(std::memory_order_relaxed);
+  }
+
+private:
+  void run_worker();
+
+  const std::size_t max_queued_;
+  task_pool task_pool_; // Outlives the queued jobs, which give their storage back to it
+  task_ring<task> jobs_; // Protected by mutex_
+  bool stopping_ = false; // Protected by mutex_
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::vector<std::thread> workers_;
+
+  std::atomic<std::uint64_t> num_completed_{0};
+  std::atomic<std::uint64_t> num_canceled_{0};
+  std::atomic<std::uint64_t> num_rejected_{0};
+};
+
+}
+
+#endif // MINICOMPS_BLOCKING_POOL_H_
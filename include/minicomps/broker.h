@@ -3,8 +3,14 @@
 #ifndef MINICOMPS_BROKER_H_
 #define MINICOMPS_BROKER_H_
 
+#include <minicomps/grace_period.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <utility>
 #include <vector>
 #include <unordered_map>
 #include <mutex>
@@ -20,21 +26,144 @@ using message_receivers = std::vector<std::weak_ptr<component>>;
 /// A broker facilitates communication between components. It knows:
 ///   - Which component listens to what message type
 ///   - Which component is interested in this information
+///
+/// Lookups don't take a lock and never wait for writers. Writers take a lock among themselves, publish a new
+/// receiver list, and wait for ongoing lookups to finish before they free the old one.
+///
+/// Message ids are spread over shards, and each shard has its own lock, table and readers, so writers only wait
+/// for each other and for lookups of the same shard. Ids from `get_message_id` are small and index an array. Any
+/// other ids, like hashes or addresses, go into a sorted side table that is copied whenever one is added.
+///
+/// A broker can have a parent. Messages without receivers in the child resolve to the parent's receivers, so a
+/// subsystem can have its own broker and still reach the rest of the process. Changes in a child never touch
+/// the parent. Changes in the parent only invalidate the child's lookups of messages that the child has no
+/// receivers of.
 class broker {
 public:
+  /// `num_shards` is rounded up to a power of two
+  explicit broker(std::size_t num_shards = 16);
+
+  /// The parent has to outlive the child
+  explicit broker(broker& parent, std::size_t num_shards = 16);
+  ~broker();
+
+  broker(const broker&) = delete;
+  broker& operator =(const broker&) = delete;
+
   void associate(message_id, std::weak_ptr<component>);
+
+  /// Does nothing if the component isn't associated with the message
   void disassociate(message_id, component*);
   void invalidate(message_id);
+
+  /// Only touches the messages that the component is associated with
   void disassociate_everything(component*);
 
   /// Returns an immutable list of weak_ptrs to all the components that are
   /// associated with this message at the time of calling the function. Creating/removing
   /// associations will expire the weak_ptr and a new call to `lookup` is necessary.
+  ///
+  /// If no component is associated with the message in this broker, the list is the parent's.
   std::weak_ptr<message_receivers> lookup(message_id);
 
+  /// Bumped every time `lookup` starts returning a new list for the message, so caches can check whether they're
+  /// stale with a plain load instead of going through the weak_ptr's control block. Read it before calling
+  /// `lookup`, so a change that races with the lookup shows up as a new generation. The counter lives as long
+  /// as the broker.
+  const std::atomic<std::uint64_t>& generation(message_id);
+
+  std::size_t num_shards() const {
+    return shards_.size();
+  }
+
 private:
-  std::unordered_map<message_id, std::shared_ptr<message_receivers>> active_lookups_;
-  std::recursive_mutex lookup_mutex_;
+  /// The receivers of one message id. Entries are never removed, so a table only needs to be copied when it
+  /// grows; a new message id is otherwise published by filling in its slot, and later changes swap the entry's
+  /// receivers.
+  struct lookup_entry {
+    std::atomic<const std::shared_ptr<message_receivers>*> receivers{nullptr}; // What lookups see
+    std::atomic<std::uint64_t> generation{0};
+    message_receivers local; // Associated with this broker. Requires the shard's write_mutex
+  };
+
+  /// Message ids are dense (see `allocate_message_id`), so each shard indexes its entries by `id / num_shards`.
+  /// Slots are filled in place, and the table is only copied when it grows.
+  struct lookup_table {
+    explicit lookup_table(std::size_t capacity)
+      : capacity(capacity)
+      , slots(new std::atomic<lookup_entry*>[capacity]()) {}
+
+    lookup_entry* find(std::size_t slot) const {
+      return slot < capacity ? slots[slot].load() : nullptr;
+    }
+
+    const std::size_t capacity;
+    const std::unique_ptr<std::atomic<lookup_entry*>[]> slots;
+  };
+
+  /// Ids too large for the array. Sorted by id, and never changes once published
+  struct sparse_table {
+    lookup_entry* find(message_id msg_id) const {
+      auto iter = std::lower_bound(std::begin(entries), std::end(entries), msg_id, [] (const auto& entry, message_id id) {
+        return entry.first < id;
+      });
+
+      return iter != std::end(entries) && iter->first == msg_id ? iter->second : nullptr;
+    }
+
+    std::vector<std::pair<message_id, lookup_entry*>> entries;
+  };
+
+  /// Keeps a stray large id from growing the array to match it
+  static constexpr std::size_t max_dense_slots = std::size_t{1} << 16;
+
+  struct alignas(64) shard {
+    std::atomic<const lookup_table*> table;
+    std::atomic<const sparse_table*> sparse{nullptr};
+    grace_period readers;
+
+    std::mutex write_mutex;
+    std::vector<std::unique_ptr<lookup_entry>> entries;
+    std::vector<const lookup_table*> retired_tables; // Freed once no lookup can see them
+    std::vector<const sparse_table*> retired_sparse_tables;
+    std::vector<const std::shared_ptr<message_receivers>*> retired_receivers;
+  };
+
+  shard& shard_for(message_id msg_id) {
+    return *shards_[msg_id & (shards_.size() - 1)];
+  }
+
+  std::size_t slot_of(message_id msg_id) const {
+    return msg_id >> shard_bits_;
+  }
+
+  /// Requires a reader section or the shard's write_mutex
+  lookup_entry* find_entry(const shard& target, message_id msg_id) const;
+
+  /// Like `lookup`, but the list is copied into a `PointerType` while it can't be freed. Children use a
+  /// shared_ptr, as a weak_ptr might expire before they get to lock it
+  template<typename PointerType>
+  PointerType lookup_as(message_id msg_id);
+
+  // The following require the shard's write_mutex to be held
+  lookup_entry& entry_for(shard& target, message_id msg_id);
+  static void remove_receiver(lookup_entry& entry, component* comp);
+  void publish(shard& target, message_id msg_id, lookup_entry& entry);
+  static void reclaim(shard& target);
+
+  /// Called by the parent when its receivers of `msg_id` have changed
+  void parent_changed(message_id msg_id);
+  void notify_children(const message_id* msg_ids, std::size_t count);
+
+  std::vector<std::unique_ptr<shard>> shards_;
+  int shard_bits_ = 0;
+
+  broker* parent_ = nullptr;
+  std::mutex children_mutex_; // Held while notifying, so children can't go away in the middle of it
+  std::vector<broker*> children_;
+
+  std::mutex associations_mutex_;
+  std::unordered_map<component*, std::vector<message_id>> associations_; // The messages of each component
 };
 } // mc
 
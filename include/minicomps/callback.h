@@ -17,13 +17,14 @@ namespace mc {
 template<typename T>
 class callback_result {
 public:
-  callback_result(executor_ptr&& receiving_executor, lifetime_weak_ptr lifetime_ptr, component* target_component, component* sender_component, const message_info& msg_info, std::function<void(mc::concrete_result<T>&&)>&& callback)
+  callback_result(executor_ptr&& receiving_executor, lifetime_weak_ptr lifetime_ptr, component* target_component, component* sender_component, const message_info& msg_info, std::function<void(mc::concrete_result<T>&&)>&& callback, lane response_lane = lane::RESPONSE)
     : msg_info_(msg_info)
     , receiving_executor_(std::move(receiving_executor))
     , lifetime_ptr_(std::move(lifetime_ptr))
     , sender_component_(sender_component)
     , target_component_(target_component)
     , callback_(std::move(callback))
+    , response_lane_(response_lane)
     {}
 
   // TODO: operator = etc
@@ -56,7 +57,7 @@ public:
         response.callback(std::move(response.result));
       };
 
-      receiving_executor_->enqueue_work(std::move(response_task), std::move(response));
+      receiving_executor_->enqueue_work(std::move(response_task), std::move(response), response_lane_);
 
       if (target_component_->listener)
         target_component_->listener->on_enqueue(sender_component_, target_component_, msg_info_, message_type::RESPONSE);
@@ -77,6 +78,13 @@ public:
     return lifetime_ptr_.expired();
   }
 
+  /// Results of direct calls, where caller and handler share an executor, call back inline. This makes them go
+  /// through the caller's executor instead, so they can be resolved from another thread.
+  void enqueue_on_caller() {
+    if (!receiving_executor_)
+      receiving_executor_ = target_component_->default_executor;
+  }
+
 private:
   const message_info& msg_info_;
   executor_ptr receiving_executor_;
@@ -84,6 +92,7 @@ private:
   component* sender_component_;
   component* target_component_;
   std::function<void(mc::concrete_result<T>&&)> callback_;
+  lane response_lane_;
 };
 
 }
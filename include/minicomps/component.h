@@ -77,6 +77,7 @@ public:
   virtual void* lookup_async_handler(message_id msg_id) = 0;
   virtual void* lookup_interface(message_id msg_id) = 0;
   virtual executor_ptr lookup_executor_override(message_id msg_id) = 0;
+  virtual lane lookup_lane(message_id msg_id) = 0;
   virtual std::vector<dependency_info> describe_dependencies() = 0;
 
   const std::string name;                /// Class name of the component's implementation
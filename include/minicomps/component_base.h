@@ -5,6 +5,7 @@
 
 #include <minicoros/coroutine.h>
 #include <minicomps/component.h>
+#include <minicomps/blocking_pool.h>
 #include <minicomps/messaging.h>
 #include <minicomps/broker.h>
 #include <minicomps/executor.h>
@@ -19,8 +20,12 @@
 #include <minicomps/if_sync_query.h>
 #include <minicomps/if_volatile_sync_query.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
@@ -46,6 +51,8 @@ protected:
     if (published_) {
       unpublish_dependencies();
     }
+
+    delete frozen_handlers_.load(std::memory_order_relaxed);
   }
 
   virtual void publish() {}
@@ -53,6 +60,7 @@ protected:
 public:
   virtual void publish_dependencies() final {
     publish();
+    freeze_handlers();
 
     published_ = true;
 
@@ -65,6 +73,12 @@ public:
     broker_.disassociate_everything(this);
     // NOTE! It's important that we remove our associations here (and cached queries etc), but we SHOULDN'T REMOVE OUR OWN HANDLERS HERE since
     // other components might still have direct pointer references to that data
+
+    // Lookups go through the maps until we're published again, so republishing doesn't rebuild the table per handler
+    {
+      std::lock_guard<std::recursive_mutex> lg(lock);
+      replace_frozen_handlers(nullptr);
+    }
     published_ = false;
   }
 
@@ -98,10 +112,13 @@ protected:
   template<typename MessageType, typename CallbackType>
   void publish_sync_query(CallbackType handler) {
     const message_id msg_id = get_message_id<MessageType>();
-    broker_.associate(msg_id, shared_from_this());
 
     using wrapper_type = typename query_info<MessageType>::handler_wrapper_type;
     sync_handlers_[msg_id] = std::make_shared<wrapper_type>(std::move(handler));
+    handlers_changed();
+
+    // Associated last, so the handler is there when the broker tells other components about us
+    broker_.associate(msg_id, shared_from_this());
     // TODO: remove from queryHandlers
     published_dependencies_.push_back({dependency_info::EXPORT, dependency_info::SYNC_MONO, get_message_info<MessageType>(), {}});
   }
@@ -114,32 +131,36 @@ protected:
     });
   }
 
-  /// Publishes a callable as an asynchronous query
+  /// Publishes a callable as an asynchronous query. Requests are enqueued in `request_lane`, and responses in
+  /// the response lane unless the request lane is higher.
   template<typename MessageType, typename CallbackType>
-  void publish_async_query(CallbackType handler, executor_ptr executor_override = nullptr) {
+  void publish_async_query(CallbackType handler, executor_ptr executor_override = nullptr, lane request_lane = lane::NORMAL) {
     const message_id msg_id = get_message_id<MessageType>();
-    broker_.associate(msg_id, shared_from_this());
 
     using async_wrapper_type = typename query_info<MessageType>::async_handler_wrapper_type;
     async_handlers_[msg_id] = std::make_shared<async_wrapper_type>(std::move(handler));
     async_executor_overrides_[msg_id] = executor_override;
+    async_lanes_[msg_id] = request_lane;
+    handlers_changed();
+    broker_.associate(msg_id, shared_from_this());
     // TODO: remove from queryHandlers
     published_dependencies_.push_back({dependency_info::EXPORT, dependency_info::ASYNC_MONO, get_message_info<MessageType>(), {}});
   }
 
   /// Publishes a member function as an asynchronous query
   template<typename MessageType, typename... ArgumentTypes>
-  void publish_async_query(void(SubclassType::*memfun)(ArgumentTypes...), executor_ptr executor_override = nullptr) {
+  void publish_async_query(void(SubclassType::*memfun)(ArgumentTypes...), executor_ptr executor_override = nullptr, lane request_lane = lane::NORMAL) {
     publish_async_query<MessageType>([this, memfun] (ArgumentTypes&&... arguments) {
       (static_cast<SubclassType*>(this)->*memfun)(std::forward<ArgumentTypes>(arguments)...);
-    }, std::move(executor_override));
+    }, std::move(executor_override), request_lane);
   }
 
   template<typename InterfaceType>
   void publish_interface(InterfaceType& impl) {
     const message_id msg_id = get_message_id<InterfaceType>();
-    broker_.associate(msg_id, shared_from_this());
     interfaces_[msg_id] = &impl;
+    handlers_changed();
+    broker_.associate(msg_id, shared_from_this());
     published_dependencies_.push_back({dependency_info::EXPORT, dependency_info::INTERFACE, get_message_info<InterfaceType>(), {}});
 
     // Add a check that verifies that all queries in the interface have been implemented
@@ -155,26 +176,26 @@ protected:
     });
   }
 
-  /// Publish a callback_result member function as an interface async query
+  /// Publish a callback_result member function as an interface async query. Requests are enqueued in `request_lane`.
   template<typename R, typename... ArgumentTypes>
-  void publish_async_query(if_async_query<R(ArgumentTypes...)>& interface_query, void(SubclassType::*memfun)(mc::callback_result<R>&&, ArgumentTypes...), executor_ptr executor_override = nullptr) {
+  void publish_async_query(if_async_query<R(ArgumentTypes...)>& interface_query, void(SubclassType::*memfun)(mc::callback_result<R>&&, ArgumentTypes...), executor_ptr executor_override = nullptr, lane request_lane = lane::NORMAL) {
     std::weak_ptr<executor> chosen_executor = executor_override ? executor_override : default_executor;
 
     interface_query.publish([this, memfun] (ArgumentTypes&&... arguments, mc::callback_result<R>&& resolver) {
       (static_cast<SubclassType*>(this)->*memfun)(std::move(resolver), std::forward<ArgumentTypes>(arguments)...);
-    }, shared_from_this(), std::move(chosen_executor));
+    }, shared_from_this(), std::move(chosen_executor), request_lane);
   }
 
-  /// Publish a minicoros member function as an interface async query
+  /// Publish a minicoros member function as an interface async query. Requests are enqueued in `request_lane`.
   template<typename R, typename... ArgumentTypes>
-  void publish_async_query(if_async_query<R(ArgumentTypes...)>& interface_query, typename signature_util<R(ArgumentTypes...)>::coroutine_type(SubclassType::*memfun)(ArgumentTypes...), executor_ptr executor_override = nullptr) {
+  void publish_async_query(if_async_query<R(ArgumentTypes...)>& interface_query, typename signature_util<R(ArgumentTypes...)>::coroutine_type(SubclassType::*memfun)(ArgumentTypes...), executor_ptr executor_override = nullptr, lane request_lane = lane::NORMAL) {
     std::weak_ptr<executor> chosen_executor = executor_override ? executor_override : default_executor;
 
     interface_query.publish([this, memfun] (ArgumentTypes&&... arguments, mc::callback_result<R>&& result_reporter) {
       (static_cast<SubclassType*>(this)->*memfun)(std::forward<ArgumentTypes>(arguments)...)
         .chain()
         .evaluate_into(std::move(result_reporter));
-    }, shared_from_this(), std::move(chosen_executor));
+    }, shared_from_this(), std::move(chosen_executor), request_lane);
   }
 
   /// Publish a member function as an interface sync query
@@ -214,6 +235,7 @@ protected:
     });
 
     // Existing references will have to be updated since we've updated the handler pointer
+    handlers_changed();
     broker_.invalidate(msg_id);
 
     // TODO: remove from queryHandlers
@@ -233,24 +255,26 @@ protected:
     }
   }
 
-  /// Publishes a callable as an event listener for asynchronous events.
+  /// Publishes a callable as an event listener for asynchronous events. Events are enqueued in `event_lane`.
   template<typename MessageType, typename CallbackType>
-  void subscribe_event(CallbackType handler) {
+  void subscribe_event(CallbackType handler, lane event_lane = lane::NORMAL) {
     const message_id msg_id = get_message_id<MessageType>();
-    broker_.associate(msg_id, shared_from_this());
 
     using handler_type = decltype(message_handler_event_impl<MessageType>{}.handler);
     async_handlers_[msg_id] = std::make_shared<message_handler_event_impl<MessageType>>(std::move(handler));
+    async_lanes_[msg_id] = event_lane;
+    handlers_changed();
+    broker_.associate(msg_id, shared_from_this());
     // TODO: remove from queryHandlers
     published_dependencies_.push_back({dependency_info::IMPORT, dependency_info::ASYNC_POLY, get_message_info<MessageType>(), {}});
   }
 
   /// Publishes a member function as an event listener for asynchronous events.
   template<typename MessageType>
-  void subscribe_event(void(SubclassType::*memfun)(const MessageType& message)) {
+  void subscribe_event(void(SubclassType::*memfun)(const MessageType& message), lane event_lane = lane::NORMAL) {
     subscribe_event<MessageType>([this, memfun] (const MessageType& message) {
       (static_cast<SubclassType*>(this)->*memfun)(message);
-    });
+    }, event_lane);
   }
 
   template<typename MessageType>
@@ -274,6 +298,24 @@ protected:
     return event<MessageType>(handler_ref.get(), this);
   };
 
+  /// Runs `job` on `pool` and resolves the coroutine with its result on this component's executor, unless the
+  /// component's default lifetime has ended by then
+  template<typename JobType, typename R = std::invoke_result_t<JobType&>>
+  mc::coroutine<R> offload(blocking_pool& pool, JobType job) {
+    return mc::coroutine<R>([this, &pool, job = std::move(job)] (mc::promise<R>&& promise) mutable {
+      callback_result<R> result{
+        executor_ptr(default_executor),
+        default_lifetime.create_weak_ptr(),
+        this,
+        this,
+        blocking_job_info,
+        [promise = std::move(promise)] (mc::concrete_result<R>&& result) {promise(std::move(result)); }
+      };
+
+      pool.submit(std::move(job), std::move(result));
+    });
+  }
+
   template<typename InterfaceType>
   interface<InterfaceType> lookup_interface() {
     auto interface_ref = std::make_shared<interface_ref_base<InterfaceType>>(broker_, *this, default_lifetime.create_weak_ptr());
@@ -291,6 +333,11 @@ protected:
   }
 
   virtual void* lookup_sync_handler(message_id msg_id) override {
+    if (const handler_table* table = frozen_handlers_.load(std::memory_order_acquire)) {
+      const handler_entry* entry = table->find(msg_id);
+      return entry ? entry->sync_handler : nullptr;
+    }
+
     std::lock_guard<std::recursive_mutex> lg(lock);
 
     auto iter = sync_handlers_.find(msg_id);
@@ -301,6 +348,11 @@ protected:
   }
 
   virtual void* lookup_async_handler(message_id msg_id) override {
+    if (const handler_table* table = frozen_handlers_.load(std::memory_order_acquire)) {
+      const handler_entry* entry = table->find(msg_id);
+      return entry ? entry->async_handler : nullptr;
+    }
+
     std::lock_guard<std::recursive_mutex> lg(lock);
 
     auto iter = async_handlers_.find(msg_id);
@@ -311,6 +363,11 @@ protected:
   }
 
   virtual void* lookup_interface(message_id msg_id) override {
+    if (const handler_table* table = frozen_handlers_.load(std::memory_order_acquire)) {
+      const handler_entry* entry = table->find(msg_id);
+      return entry ? entry->interface : nullptr;
+    }
+
     std::lock_guard<std::recursive_mutex> lg(lock);
 
     auto iter = interfaces_.find(msg_id);
@@ -321,6 +378,11 @@ protected:
   }
 
   virtual executor_ptr lookup_executor_override(message_id msg_id) override {
+    if (const handler_table* table = frozen_handlers_.load(std::memory_order_acquire)) {
+      const handler_entry* entry = table->find(msg_id);
+      return entry ? entry->executor_override : nullptr;
+    }
+
     std::lock_guard<std::recursive_mutex> lg(lock);
 
     auto iter = async_executor_overrides_.find(msg_id);
@@ -330,16 +392,106 @@ protected:
     return iter->second;
   }
 
+  virtual lane lookup_lane(message_id msg_id) override {
+    if (const handler_table* table = frozen_handlers_.load(std::memory_order_acquire)) {
+      const handler_entry* entry = table->find(msg_id);
+      return entry ? entry->request_lane : lane::NORMAL;
+    }
+
+    std::lock_guard<std::recursive_mutex> lg(lock);
+
+    auto iter = async_lanes_.find(msg_id);
+    if (iter == std::end(async_lanes_))
+      return lane::NORMAL;
+
+    return iter->second;
+  }
+
   void add_dependency_info(dependency_info&& info) {
     published_dependencies_.push_back(std::move(info));
   }
 
 private:
+  /// Everything the component has published for one message, so a lookup is one search
+  struct handler_entry {
+    message_id msg_id;
+    void* sync_handler = nullptr;
+    void* async_handler = nullptr;
+    void* interface = nullptr;
+    executor_ptr executor_override;
+    lane request_lane = lane::NORMAL;
+  };
+
+  /// Sorted by message id. Never changes once built
+  struct handler_table {
+    const handler_entry* find(message_id msg_id) const {
+      auto iter = std::lower_bound(std::begin(entries), std::end(entries), msg_id, [] (const handler_entry& entry, message_id id) {
+        return entry.msg_id < id;
+      });
+
+      return iter != std::end(entries) && iter->msg_id == msg_id ? &*iter : nullptr;
+    }
+
+    std::vector<handler_entry> entries;
+  };
+
+  /// Copies the handler maps into a new table that lookups read without taking `lock`
+  void freeze_handlers() {
+    std::lock_guard<std::recursive_mutex> lg(lock);
+    std::map<message_id, handler_entry> entries;
+
+    auto entry_for = [&] (message_id msg_id) -> handler_entry& {
+      handler_entry& entry = entries[msg_id];
+      entry.msg_id = msg_id;
+      return entry;
+    };
+
+    for (const auto& [msg_id, handler] : sync_handlers_)
+      entry_for(msg_id).sync_handler = handler->get_handler_ptr();
+
+    for (const auto& [msg_id, handler] : async_handlers_)
+      entry_for(msg_id).async_handler = handler->get_handler_ptr();
+
+    for (const auto& [msg_id, impl] : interfaces_)
+      entry_for(msg_id).interface = impl;
+
+    for (const auto& [msg_id, executor_override] : async_executor_overrides_)
+      entry_for(msg_id).executor_override = executor_override;
+
+    for (const auto& [msg_id, request_lane] : async_lanes_)
+      entry_for(msg_id).request_lane = request_lane;
+
+    auto* table = new handler_table;
+    table->entries.reserve(entries.size());
+
+    for (auto& [_, entry] : entries)
+      table->entries.push_back(std::move(entry));
+
+    replace_frozen_handlers(table);
+  }
+
+  /// Lookups might still be reading the old table, so it's kept until the component is destroyed. Requires `lock`
+  void replace_frozen_handlers(const handler_table* table) {
+    if (const handler_table* old_table = frozen_handlers_.exchange(table, std::memory_order_acq_rel))
+      retired_handler_tables_.emplace_back(old_table);
+  }
+
+  /// Rebuilds the frozen table, if there is one, after handlers were added or replaced
+  void handlers_changed() {
+    if (frozen_handlers_.load(std::memory_order_relaxed))
+      freeze_handlers();
+  }
+
   broker& broker_;
   std::unordered_map<message_id, std::shared_ptr<message_handler>> sync_handlers_;
   std::unordered_map<message_id, std::shared_ptr<message_handler>> async_handlers_;
   std::unordered_map<message_id, void*> interfaces_;
   std::unordered_map<message_id, executor_ptr> async_executor_overrides_;
+  std::unordered_map<message_id, lane> async_lanes_;
+
+  // Built once publishing is done, and only rebuilt when handlers change after that, which is rare
+  std::atomic<const handler_table*> frozen_handlers_{nullptr};
+  std::vector<std::unique_ptr<const handler_table>> retired_handler_tables_;
 
   std::vector<std::shared_ptr<mono_ref>> mono_refs_; // Reset shared_ptrs in mono_refs to avoid memory leaks at shutdown
   std::vector<std::shared_ptr<poly_ref>> poly_refs_; // ... and in poly_refs TODO: common base class
@@ -18,26 +18,48 @@ public:
 
   void operator() (MessageType&& event) {
     component_listener* listener = owning_component_->listener;
+    auto& receivers = handler_->lookup();
+
+    for (std::size_t first = 0; first < receivers.size();) {
+      auto& receiver_handler = receivers[first];
 
-    for (auto& receiver_handler : handler_->lookup()) {
       if (receiver_handler.mutual_executor()) {
         if (listener)
           listener->on_invoke(owning_component_, receiver_handler.receiver().get(), msg_info_, message_type::EVENT);
 
         receiver_handler.invoke(event);
+        ++first;
+        continue;
       }
-      else {
-        if (listener)
-          listener->on_enqueue(owning_component_, receiver_handler.receiver().get(), msg_info_, message_type::EVENT);
 
-        // TODO: make sure we copy
-        auto task = [handler = receiver_handler.handler()](void* data) {
+      // Receivers that share a queue are next to each other, and get their copies of the event in one batch
+      std::size_t last = first + 1;
+
+      while (last < receivers.size() && receiver_handler.shares_queue_with(receivers[last]))
+        ++last;
+
+      executor& receiving_executor = *receiver_handler.receiver()->default_executor;
+
+      if (!receiving_executor.admit(work_kind::EVENT, last - first)) {
+        first = last;
+        continue;
+      }
+
+      if (listener) {
+        for (std::size_t i = first; i < last; ++i)
+          listener->on_enqueue(owning_component_, receivers[i].receiver().get(), msg_info_, message_type::EVENT);
+      }
+
+      receiving_executor.enqueue_batch(last - first, receiver_handler.receiver_lane(), [&] (std::size_t index, auto&& enqueue) {
+        auto task = [handler = receivers[first + index].handler()](void* data) {
           MessageType* event = static_cast<MessageType*>(data);
           (*handler)(*event);
         };
 
-        receiver_handler.receiver()->default_executor->enqueue_work(std::move(task), event);
-      }
+        enqueue(std::move(task), event);
+      });
+
+      first = last;
     }
   }
 
@@ -3,69 +3,609 @@
 #ifndef MINICOMPS_EXECUTOR_H_
 #define MINICOMPS_EXECUTOR_H_
 
-#include <minicomps/fixed_any.h>
+#include <minicomps/executor_stats.h>
+#include <minicomps/io_poller.h>
+#include <minicomps/mpsc_queue.h>
+#include <minicomps/spsc_queue.h>
+#include <minicomps/task.h>
+#include <minicomps/task_pool.h>
+#include <minicomps/task_ring.h>
+#include <minicomps/timer_wheel.h>
+#include <minicomps/wakeup_event.h>
 
 #include <vector>
-#include <functional>
 #include <memory>
 #include <mutex>
 #include <chrono>
 #include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <type_traits>
 
 namespace mc {
 
+class executor_pool;
+
+/// How an executor synchronizes producers and the consumer
+enum class queue_type {
+  LOCKING,        /// Chunked double buffer protected by a std::mutex. Cheap when there's little contention
+  LOCK_FREE_MPSC, /// Lock-free chain of ring segments; producers don't block each other or the consumer
+  SPSC_CHANNELS   /// One wait-free queue per producing thread; producers never share cache lines with each other
+};
+
+/// Tasks in higher lanes are executed before tasks in lower lanes. Tasks in the same lane run in order.
+enum class lane : std::uint8_t {
+  CONTROL,  /// Latency-critical work
+  RESPONSE, /// Responses to async queries. Finishing work that is already in flight frees up resources sooner
+  NORMAL,   /// Requests and events unless they were published with another lane
+  BULK      /// Work that can wait
+};
+
+constexpr std::size_t num_lanes = 4;
+
+/// What happens to work that arrives while a bounded executor's queue is full
+enum class overflow_policy {
+  BLOCK,        /// Producers wait until the consumer has made room
+  FAIL_QUERIES, /// Async queries fail right away with `query_error::overloaded`; other work is enqueued anyway
+  DROP_OLDEST,  /// The consumer discards the oldest tasks in the normal and bulk lanes until it's back under capacity
+  DROP_EVENTS   /// Events are discarded; other work is enqueued anyway
+};
+
+/// What a producer is about to enqueue, so the overflow policy can tell work apart
+enum class work_kind : std::uint8_t {
+  TASK,
+  REQUEST,
+  RESPONSE, /// Always admitted, since the requester is waiting for it
+  EVENT
+};
+
 /// A work queue.
 class executor {
 public:
-  executor() {}
+  executor(queue_type type = queue_type::LOCKING, std::size_t ring_capacity = 1024);
+  ~executor();
+
+  executor(const executor&) = delete;
+  executor& operator =(const executor&) = delete;
 
   template<typename CallbackType, typename DataType>
-  void enqueue_work(CallbackType item, DataType&& data) {
-    if (!mutex_.try_lock()) {
-      ++num_lock_failures_;
-      mutex_.lock();
+  void enqueue_work(CallbackType&& item, DataType&& data, lane target_lane = lane::NORMAL) {
+    executor* staging = staging_executor_;
+
+    if (staging && staging != this) {
+      staging->stage(*this, std::forward<CallbackType>(item), std::forward<DataType>(data), target_lane);
+      return;
     }
 
-    task& work_item = work_items_.emplace_back();
-    work_item.fun = std::move(item);
-    work_item.data.assign(std::move(data));
-    mutex_.unlock();
+    // Only a few tasks carry a timestamp, which keeps the clock out of the common path
+    if (num_enqueued_.fetch_add(1, std::memory_order_relaxed) % latency_sample_interval == 0) {
+      using timed_type = timed_callback<std::decay_t<CallbackType>>;
+      enqueue_task(timed_type{std::forward<CallbackType>(item), this, std::chrono::steady_clock::now()}, std::forward<DataType>(data), target_lane);
+    }
+    else {
+      enqueue_task(std::forward<CallbackType>(item), std::forward<DataType>(data), target_lane);
+    }
   }
 
-  void execute() {
-    if (!mutex_.try_lock()) {
-      ++num_lock_failures_;
-      mutex_.lock();
+  /// Enqueues `count` tasks in `target_lane` with one synchronization step instead of one per task.
+  /// `produce(index, enqueue)` is called for every index in order and has to call `enqueue(callback, data)` exactly
+  /// once. The tasks end up next to each other in the queue, or for lock-free executors, in runs of up to a ring
+  /// segment each. For locking executors `produce` is called while the queue is locked, so it mustn't enqueue
+  /// anything on this executor.
+  template<typename ProduceType>
+  void enqueue_batch(std::size_t count, lane target_lane, ProduceType&& produce) {
+    if (count == 0)
+      return;
+
+    executor* staging = staging_executor_;
+
+    if (staging && staging != this) {
+      // Staged tasks would otherwise be overtaken by the batch
+      for (std::size_t i = 0; i < count; ++i) {
+        produce(i, [&] (auto&& callback, auto&& data) {
+          staging->stage(*this, std::forward<decltype(callback)>(callback), std::forward<decltype(data)>(data), target_lane);
+        });
+      }
+
+      return;
     }
 
-    std::swap(work_items_, work_items_back_buffer_);
-    mutex_.unlock();
+    const std::uint64_t first_sequence = num_enqueued_.fetch_add(count, std::memory_order_relaxed);
+    const std::size_t lane_index = static_cast<std::size_t>(target_lane);
+    bool wake_consumer = false;
 
-    for (auto& item : work_items_back_buffer_)
-      item.execute();
+    // Adapts the queue's emplace function to the tasks' constructor
+    auto produce_task = [&] (std::size_t index, auto&& emplace) {
+      produce(index, [&] (auto&& callback, auto&& data) {
+        if ((first_sequence + index) % latency_sample_interval == 0) {
+          using timed_type = timed_callback<std::decay_t<decltype(callback)>>;
+          emplace(timed_type{std::forward<decltype(callback)>(callback), this, std::chrono::steady_clock::now()}, std::forward<decltype(data)>(data), &task_pool_);
+        }
+        else {
+          emplace(std::forward<decltype(callback)>(callback), std::forward<decltype(data)>(data), &task_pool_);
+        }
+      });
+    };
 
-    work_items_back_buffer_.clear();
+    switch (type_) {
+    case queue_type::LOCKING: {
+      if (!mutex_.try_lock()) {
+        count_lock_failure();
+        mutex_.lock();
+      }
+
+      task_ring<task>& items = locking_lanes_[lane_index].items;
+
+      for (std::size_t i = 0; i < count; ++i) {
+        produce_task(i, [&] (auto&&... arguments) {
+          items.emplace_back(std::forward<decltype(arguments)>(arguments)...);
+        });
+      }
+
+      wake_consumer = claim_waiting_consumer();
+      mutex_.unlock();
+      break;
+    }
+
+    case queue_type::LOCK_FREE_MPSC:
+      lock_free_lane(lane_index).emplace_batch(count, produce_task);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      wake_consumer = claim_waiting_consumer();
+      break;
+
+    case queue_type::SPSC_CHANNELS:
+      producer_channel().producer_lane(lane_index).emplace_batch(count, produce_task);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      wake_consumer = claim_waiting_consumer();
+      break;
+    }
+
+    if (wake_consumer)
+      signal_consumer();
+
+    notify_pool();
+  }
+
+  /// Bounds the queue to roughly `capacity` tasks, zero meaning unbounded, and decides what happens to work that
+  /// arrives while it's full. Producers that race each other can overshoot by a few tasks. Set it up before work
+  /// starts arriving. Don't use BLOCK on executors that send to each other in a cycle, or on an executor_pool
+  /// whose workers could all end up waiting.
+  void limit_queue(std::size_t capacity, overflow_policy policy) {
+    overflow_policy_ = policy;
+    capacity_.store(capacity, std::memory_order_release);
+  }
+
+  /// Called by producers before they enqueue `count` tasks of `kind`. Returns false if the work has to be rejected
+  /// because the queue is full. Might block, depending on the overflow policy. Messaging does this for requests and
+  /// events; other producers only need to if they want their tasks to count against the limit.
+  bool admit(work_kind kind, std::size_t count = 1) {
+    const std::size_t capacity = capacity_.load(std::memory_order_acquire);
+
+    if (capacity == 0 || kind == work_kind::RESPONSE)
+      return true;
+
+    return admit_bounded(kind, count, capacity);
+  }
+
+  /// Executes the tasks that were enqueued before the call, lane by lane
+  void execute();
+
+  /// Executes tasks in order until the queue is empty, `max_tasks` tasks have run or `deadline` has passed.
+  /// Tasks that didn't get to run stay queued, in order, for the next call. Returns the number of executed tasks.
+  /// A lane that doesn't get to run for `max_starved_passes` calls in a row goes first in the next call.
+  std::size_t execute(std::size_t max_tasks, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+  /// Like execute, but gives up and returns false instead of waiting if a producer is holding the queue lock
+  bool try_execute(std::size_t max_tasks = std::numeric_limits<std::size_t>::max(), std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+  /// Blocks until there's work to execute or `timeout` has passed, and returns whether there's work.
+  /// Only one thread at a time can wait, and it has to be the thread that calls `execute`. Don't use this on
+  /// an executor that is attached to an executor_pool.
+  bool wait_for_work(std::chrono::steady_clock::duration timeout);
+
+  /// Runs `callback` from `execute` once `delay` has passed, unless `life` has ended or the timer has been canceled.
+  /// Timers belong to the thread that runs the executor, so only schedule and cancel them from tasks on this
+  /// executor or from that thread. An executor attached to an executor_pool only runs its timers when it has
+  /// been scheduled because of other work.
+  template<typename CallbackType>
+  timer_handle schedule_timer(std::chrono::steady_clock::duration delay, const lifetime& life, CallbackType callback) {
+    return timers().schedule(std::chrono::steady_clock::now(), delay, std::chrono::steady_clock::duration::zero(), life, std::move(callback));
+  }
+
+  /// Like schedule_timer, but keeps running `callback` every `period` until `life` ends or the timer is canceled
+  template<typename CallbackType>
+  timer_handle schedule_periodic_timer(std::chrono::steady_clock::duration period, const lifetime& life, CallbackType callback) {
+    return timers().schedule(std::chrono::steady_clock::now(), period, period, life, std::move(callback));
+  }
+
+  bool cancel_timer(timer_handle handle) {
+    return timers_ && timers_->cancel(handle);
+  }
+
+  /// Runs `callback(ready_events)` from `execute` whenever `fd` is ready for any of `events` (EPOLLIN, EPOLLOUT, ...),
+  /// until `life` ends or the fd is unwatched. From then on, `wait_for_work` waits for the fds and for enqueued work in
+  /// the same syscall. Like timers, fds belong to the thread that runs the executor, and an executor attached to an
+  /// executor_pool only polls them when it has been scheduled because of other work. Returns false if the fd can't
+  /// be watched, which is always the case outside of Linux.
+  bool watch_fd(int fd, std::uint32_t events, const lifetime& life, std::function<void(std::uint32_t)> callback);
+
+  /// Stops watching the fd. Do this before closing it.
+  bool unwatch_fd(int fd) {
+    return io_ && io_->unwatch(fd);
+  }
+
+  /// Holds back the tasks that this executor's tasks enqueue on other executors, and hands them over in one batch
+  /// per executor once the execute pass is over, or as soon as `flush_threshold` tasks are waiting for the same
+  /// executor. Trades a bit of latency for less synchronization in chatty pipelines. Only call this from the thread
+  /// that runs the executor, and don't destroy an executor while tasks for it are held back.
+  void enable_outbound_staging(std::size_t flush_threshold = 64) {
+    staging_threshold_ = flush_threshold;
+  }
+
+  void disable_outbound_staging() {
+    staging_threshold_ = 0;
+  }
+
+  /// The executor whose execute pass is running on this thread, if any
+  static executor* current() {
+    return running_executor_;
+  }
+
+  /// Counts a request that was failed instead of handled because its deadline passed while it was queued. Only
+  /// called from the executor's own tasks.
+  void count_expired_request() {
+    expired_requests_.store(expired_requests_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  /// Counts a request that was skipped because its caller's lifetime had ended. Only called from the executor's
+  /// own tasks. If the queue is long, the next pass starts by compacting it, since callers tend to go away in bulk.
+  void count_canceled_request() {
+    canceled_requests_.store(canceled_requests_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    found_canceled_ = true;
+  }
+
+  /// Destroys queued tasks that have been canceled, like requests whose caller's lifetime has ended, without
+  /// running them. The rest keep their order. Returns the number of removed tasks. Only call this from the
+  /// thread that runs the executor.
+  std::size_t compact();
+
+  /// Reads the executor's counters. Can be called from any thread; the counters are read one by one, so they
+  /// might not be exactly in sync with each other.
+  executor_stats stats() const;
+
+  queue_type type() const {
+    return type_;
+  }
+
+  /// Number of tasks whose data was too large to be stored inline in the queue, and had to be put in
+  /// pooled storage instead
+  std::uint64_t num_oversized_tasks() const {
+    return task_pool_.num_allocations();
   }
 
   static int num_lock_failures() {
     return num_lock_failures_;
   }
 
+  static constexpr int max_starved_passes = 4;
+  static constexpr std::uint64_t latency_sample_interval = 64;
+  static constexpr std::uint64_t pass_sample_interval = 16;
+  static constexpr std::uint64_t compaction_threshold = 256; /// Queue depth at which a canceled request triggers compaction
+  static constexpr std::uint64_t executed_publish_interval = 16; /// Executed tasks between updates of the queue depth during a pass
+
 private:
   static std::atomic_int num_lock_failures_;
 
-  struct task {
-    fixed_any<96> data;
-    std::function<void(void*)> fun;
+public:
+  /// Inbound queues from one producing thread, one per lane. Shared between the executor and the thread's
+  /// channel cache. Lanes are created when the producer first uses them.
+  struct channel {
+    channel() = default;
+    channel(const channel&) = delete;
+    channel& operator =(const channel&) = delete;
+
+    ~channel() {
+      for (auto& lane_items : lanes)
+        delete lane_items.load(std::memory_order_relaxed);
+    }
+
+    spsc_queue<task>& producer_lane(std::size_t lane_index) {
+      spsc_queue<task>* items = lanes[lane_index].load(std::memory_order_relaxed);
+
+      if (!items) {
+        items = new spsc_queue<task>;
+        lanes[lane_index].store(items, std::memory_order_release);
+      }
 
-    void execute() {
-      fun(data.get_object_ptr());
+      return *items;
     }
+
+    std::atomic<spsc_queue<task>*> lanes[num_lanes] = {};
+    std::atomic_bool closed{false};
   };
 
-  std::vector<task> work_items_;
-  std::vector<task> work_items_back_buffer_;
-  std::chrono::steady_clock::time_point last_execute_;
+private:
+  friend class executor_pool;
+
+  template<typename CallbackType, typename DataType>
+  void enqueue_task(CallbackType&& item, DataType&& data, lane target_lane) {
+    const std::size_t lane_index = static_cast<std::size_t>(target_lane);
+    bool wake_consumer = false;
+
+    switch (type_) {
+    case queue_type::LOCKING:
+      if (!mutex_.try_lock()) {
+        count_lock_failure();
+        mutex_.lock();
+      }
+
+      locking_lanes_[lane_index].items.emplace_back(std::forward<CallbackType>(item), std::forward<DataType>(data), &task_pool_);
+      wake_consumer = claim_waiting_consumer();
+      mutex_.unlock();
+      break;
+
+    case queue_type::LOCK_FREE_MPSC:
+      lock_free_lane(lane_index).emplace(std::forward<CallbackType>(item), std::forward<DataType>(data), &task_pool_);
+      std::atomic_thread_fence(std::memory_order_seq_cst); // Pairs with the fence in wait_for_work
+      wake_consumer = claim_waiting_consumer();
+      break;
+
+    case queue_type::SPSC_CHANNELS:
+      producer_channel().producer_lane(lane_index).emplace(std::forward<CallbackType>(item), std::forward<DataType>(data), &task_pool_);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      wake_consumer = claim_waiting_consumer();
+      break;
+    }
+
+    if (wake_consumer)
+      signal_consumer();
+
+    notify_pool();
+  }
+
+  /// Wraps callbacks of tasks whose enqueue-to-execute latency is sampled
+  template<typename CallbackType>
+  struct timed_callback {
+    CallbackType callback;
+    executor* target;
+    std::chrono::steady_clock::time_point enqueued_at;
+
+    void operator()(void* data) {
+      target->enqueue_to_execute_.record(std::chrono::steady_clock::now() - enqueued_at);
+      callback(data);
+    }
+  };
+
+  void count_lock_failure() {
+    ++num_lock_failures_;
+    lock_failures_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// Finds (or creates) the channel that the calling thread uses to send to this executor
+  channel& producer_channel();
+
+  /// Returns false if `wait_for_lock` is false and the queue lock was contended
+  template<typename BudgetType>
+  bool execute_within(BudgetType& budget, bool wait_for_lock);
+
+  template<typename BudgetType>
+  bool execute_tasks(BudgetType& budget, bool wait_for_lock);
+
+  template<typename BudgetType>
+  void execute_lane(std::size_t lane_index, BudgetType& budget, std::size_t first_channel);
+
+  /// Adds `count` executed tasks to the queue depth and wakes up producers that wait for space
+  void publish_executed(std::uint64_t count);
+  void signal_space_available();
+
+  /// Calls `callback` for the lane's tasks in order until `should_stop` returns true. Tasks are popped after the call.
+  template<typename CallbackType, typename StopPredicateType>
+  void consume_lane(std::size_t lane_index, std::size_t first_channel, CallbackType&& callback, StopPredicateType&& should_stop);
+
+  /// Discards the oldest bulk and normal tasks until the queue is back under capacity
+  void drop_oldest(std::size_t first_channel);
+
+  /// Compacts the tasks that the consumer can see
+  std::size_t remove_canceled();
+
+  bool admit_bounded(work_kind kind, std::size_t count, std::size_t capacity);
+  void wait_for_space(std::size_t capacity);
+
+  /// Tasks that are enqueued but neither executed, dropped nor compacted away. Read by producers too, so it can lag behind.
+  std::uint64_t queue_depth() const {
+    const std::uint64_t retired = num_executed_.load(std::memory_order_relaxed) + num_dropped_.load(std::memory_order_relaxed) + num_compacted_.load(std::memory_order_relaxed);
+    const std::uint64_t enqueued = num_enqueued_.load(std::memory_order_relaxed);
+    return enqueued > retired ? enqueued - retired : 0;
+  }
+
+  /// Moves every lane's enqueued tasks to its back buffer
+  bool take_locking_snapshot(bool wait_for_lock);
+  void refresh_channels(bool wait_for_lock);
+
+  mpsc_queue<task>& lock_free_lane(std::size_t lane_index) {
+    if (mpsc_queue<task>* items = lock_free_lanes_[lane_index].load(std::memory_order_acquire))
+      return *items;
+
+    return create_lock_free_lane(lane_index);
+  }
+
+  mpsc_queue<task>& create_lock_free_lane(std::size_t lane_index);
+
+  /// Tasks held back for one target executor while outbound staging is enabled
+  struct staged_batch {
+    executor* target;
+    task_ring<task> lanes[num_lanes];
+    std::size_t size = 0;
+  };
+
+  template<typename CallbackType, typename DataType>
+  void stage(executor& target, CallbackType&& item, DataType&& data, lane target_lane) {
+    staged_batch& batch = staged_batch_for(target);
+    batch.lanes[static_cast<std::size_t>(target_lane)].emplace_back(std::forward<CallbackType>(item), std::forward<DataType>(data), &target.task_pool_);
+    ++num_staged_;
+
+    if (++batch.size >= staging_threshold_)
+      flush_staged(batch);
+  }
+
+  staged_batch& staged_batch_for(executor& target);
+  void flush_staged();
+  void flush_staged(staged_batch& batch);
+
+  /// Moves the staged tasks into our queue, each lane with one synchronization step
+  void enqueue_staged(staged_batch& batch);
+
+  timer_wheel& timers() {
+    if (!timers_)
+      timers_ = std::make_unique<timer_wheel>();
+
+    return *timers_;
+  }
+
+  /// Only called by the consumer. Returns the number of timers that fired.
+  std::size_t run_expired_timers() {
+    if (!timers_ || timers_->size() == 0)
+      return 0;
+
+    return timers_->advance(std::chrono::steady_clock::now());
+  }
+
+  bool lock_queue(bool wait_for_lock);
+
+  /// Only called by the consumer
+  bool has_pending_work();
+
+  /// Only called by the consumer. Returns the number of fd callbacks that ran.
+  std::size_t run_ready_io() {
+    if (!io_ || io_->size() == 0)
+      return 0;
+
+    return io_->run_ready();
+  }
+
+  /// Wakes the consumer from wait_for_work, which sleeps in epoll_wait instead of on the futex once fds are watched
+  void signal_consumer() {
+    if (io_poller* io = io_wakeup_.load(std::memory_order_acquire))
+      io->wake();
+    else
+      wakeup_.signal();
+  }
+
+  /// Only the first producer after the consumer started waiting gets to wake it up, so producers don't
+  /// make syscalls while the consumer is busy or already about to wake up.
+  bool claim_waiting_consumer() {
+    return consumer_waiting_.load(std::memory_order_relaxed) && consumer_waiting_.exchange(false, std::memory_order_relaxed);
+  }
+
+  /// Hands the executor to a pool worker unless it's already scheduled. If a worker is running it, the worker
+  /// is told to run it again.
+  void notify_pool() {
+    if (!pool_attached_.load(std::memory_order_relaxed))
+      return;
+
+    // Pairs with the fence in executor_pool::run_worker: either the worker sees our task, or we see that
+    // the worker has released the strand
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    strand_state state = strand_state_.load(std::memory_order_relaxed);
+
+    for (;;) {
+      switch (state) {
+      case strand_state::IDLE:
+        if (strand_state_.compare_exchange_weak(state, strand_state::SCHEDULED, std::memory_order_acq_rel)) {
+          schedule_on_pool();
+          return;
+        }
+        break;
+
+      case strand_state::RUNNING:
+        if (strand_state_.compare_exchange_weak(state, strand_state::RUNNING_NOTIFIED, std::memory_order_acq_rel))
+          return;
+        break;
+
+      default:
+        return;
+      }
+    }
+  }
+
+  void schedule_on_pool();
+
+  struct locking_lane {
+    task_ring<task> items;       // Protected by mutex_
+    task_ring<task> back_buffer; // Enqueued tasks that haven't been executed yet
+  };
+
+  const queue_type type_;
+  const std::uint64_t id_;
+  const std::size_t ring_capacity_;
+  task_pool task_pool_; // Outlives the queues, since queued tasks give their storage back to it
+  locking_lane locking_lanes_[num_lanes];
+  std::atomic<mpsc_queue<task>*> lock_free_lanes_[num_lanes] = {}; // Created on first use
+  int starved_passes_[num_lanes] = {};
+
+  std::vector<std::shared_ptr<channel>> channels_;          // Protected by mutex_
+  std::vector<std::shared_ptr<channel>> consumer_channels_; // Only touched by the consumer
+  std::atomic_bool channels_changed_{false};
+  std::size_t next_channel_ = 0;
+
+  // Strand state when attached to an executor_pool. Only one worker can move the executor out of SCHEDULED,
+  // which guarantees that it's never executed by more than one worker at a time.
+  enum class strand_state {
+    DETACHED,         /// Not attached to a pool; producers don't do anything
+    IDLE,             /// Attached but nothing to do; the next producer schedules the executor
+    SCHEDULED,        /// Queued on a worker
+    RUNNING,          /// A worker is executing it
+    RUNNING_NOTIFIED  /// A worker is executing it and more work has arrived since it started
+  };
+
+  std::atomic_bool pool_attached_{false};
+  std::atomic<strand_state> strand_state_{strand_state::DETACHED};
+  executor_pool* pool_ = nullptr;
+
+  std::atomic_bool consumer_waiting_{false};
+  wakeup_event wakeup_;
+
+  std::unique_ptr<timer_wheel> timers_; // Created when the first timer is scheduled
+  std::unique_ptr<io_poller> io_;       // Created when the first fd is watched
+  std::atomic<io_poller*> io_wakeup_{nullptr}; // Set once an fd has been watched, for producers
+
+  // Outbound staging. Only touched by the thread running the executor.
+  std::size_t staging_threshold_ = 0;     // Zero when disabled
+  std::vector<std::unique_ptr<staged_batch>> staged_batches_;
+  std::size_t last_staged_batch_ = 0;
+  std::size_t num_staged_ = 0;
+
+  /// The executor whose execute pass is running on this thread, if it stages its outbound tasks
+  inline static thread_local executor* staging_executor_ = nullptr;
+
+  /// The executor whose execute pass is running on this thread. Its own tasks never block on it.
+  inline static thread_local executor* running_executor_ = nullptr;
+
+  // Bounded queue
+  std::atomic<std::size_t> capacity_{0}; // Zero when unbounded
+  overflow_policy overflow_policy_ = overflow_policy::BLOCK;
+  std::atomic<std::uint32_t> blocked_producers_{0};
+  wakeup_event space_available_;
+
+  // Instrumentation. The consumer's counters are only written by the thread running the executor.
+  alignas(64) std::atomic<std::uint64_t> num_enqueued_{0};
+  std::atomic<std::uint64_t> lock_failures_{0};
+  std::atomic<std::uint64_t> blocked_enqueues_{0};
+  std::atomic<std::uint64_t> rejected_queries_{0};
+  std::atomic<std::uint64_t> dropped_events_{0};
+  alignas(64) std::atomic<std::uint64_t> num_executed_{0};
+  std::atomic<std::uint64_t> num_dropped_{0};
+  std::atomic<std::uint64_t> expired_requests_{0};
+  std::atomic<std::uint64_t> canceled_requests_{0};
+  std::atomic<std::uint64_t> num_compacted_{0};
+  bool found_canceled_ = false;
+  std::atomic<std::uint64_t> peak_queue_depth_{0};
+  std::atomic<std::uint64_t> num_passes_{0};
+  std::uint64_t num_busy_passes_ = 0;
+  duration_recorder enqueue_to_execute_;
+  duration_recorder pass_duration_;
+
   std::mutex mutex_;
 };
 
@@ -0,0 +1,78 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_EXECUTOR_POOL_H_
+#define MINICOMPS_EXECUTOR_POOL_H_
+
+#include <minicomps/executor.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mc {
+
+/// Runs executors on a fixed set of worker threads, so that components don't need their own pump loops.
+/// Executors are scheduled as strands: an executor is handed to a worker when it goes from idle to having
+/// work, and it's never executed by more than one worker at a time. This keeps the single-threaded guarantee
+/// that components sharing an executor rely on. Idle workers steal ready executors from busy ones.
+///
+/// Attached executors must not be executed manually.
+class executor_pool {
+public:
+  explicit executor_pool(std::size_t num_workers = std::thread::hardware_concurrency());
+  ~executor_pool();
+
+  executor_pool(const executor_pool&) = delete;
+  executor_pool& operator =(const executor_pool&) = delete;
+
+  /// Starts running the executor on the pool. Work that's already queued gets scheduled immediately.
+  void attach(const executor_ptr& exec);
+
+  /// Stops running the executor on the pool. Waits for the executor to finish if a worker is running it, so
+  /// this can't be called from one of the executor's own tasks. Remaining work is left in the executor.
+  void detach(const executor_ptr& exec);
+
+  std::size_t num_workers() const {
+    return workers_.size();
+  }
+
+private:
+  friend class executor;
+
+  /// Ready executors for one worker. A ring buffer that can hold every attached executor, since an executor
+  /// is in at most one queue at a time. That way scheduling never allocates.
+  struct worker {
+    std::mutex mutex;
+    std::vector<executor*> ready;
+    std::size_t head = 0;
+    std::size_t count = 0;
+    std::thread thread;
+  };
+
+  void schedule(executor* exec);
+  void push(worker& target, executor* exec);
+  executor* pop_front(worker& source);
+  executor* pop_back(worker& source);
+  executor* find_work(std::size_t worker_index);
+  void wait_for_work();
+  void run_worker(std::size_t worker_index);
+
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::vector<executor_ptr> attached_; // Protected by attach_mutex_
+  std::mutex attach_mutex_;
+
+  std::atomic<std::size_t> next_worker_{0};
+  std::atomic<std::size_t> num_ready_{0};
+  std::atomic<std::size_t> num_sleeping_{0};
+  std::atomic_bool stopping_{false};
+  std::mutex sleep_mutex_;
+  std::condition_variable wakeup_;
+};
+
+}
+
+#endif // MINICOMPS_EXECUTOR_POOL_H_
@@ -0,0 +1,96 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_EXECUTOR_STATS_H_
+#define MINICOMPS_EXECUTOR_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace mc {
+
+/// Counts durations in power-of-two buckets of nanoseconds: bucket `i` holds durations below 2^(i + 1) ns that
+/// didn't fit in an earlier bucket. The last bucket also holds everything longer.
+struct duration_histogram {
+  static constexpr std::size_t num_buckets = 40; // About 18 minutes
+
+  std::uint64_t buckets[num_buckets] = {};
+
+  std::uint64_t count() const {
+    std::uint64_t total = 0;
+
+    for (std::uint64_t bucket : buckets)
+      total += bucket;
+
+    return total;
+  }
+
+  /// Returns an upper bound for the duration that `fraction` of the samples stay below, or zero without samples
+  std::chrono::nanoseconds percentile(double fraction) const {
+    const std::uint64_t total = count();
+    if (total == 0)
+      return std::chrono::nanoseconds::zero();
+
+    std::uint64_t seen = 0;
+
+    for (std::size_t i = 0; i < num_buckets; ++i) {
+      seen += buckets[i];
+
+      if (seen >= fraction * total)
+        return std::chrono::nanoseconds(std::uint64_t{2} << i);
+    }
+
+    return std::chrono::nanoseconds(std::uint64_t{2} << (num_buckets - 1));
+  }
+};
+
+/// Point-in-time view of an executor's counters, from executor::stats()
+struct executor_stats {
+  std::uint64_t enqueued_tasks = 0;
+  std::uint64_t executed_tasks = 0;   /// Not counting timers
+  std::uint64_t queue_depth = 0;      /// Tasks that have been enqueued but not executed, dropped or compacted yet
+  std::uint64_t peak_queue_depth = 0; /// Highest depth seen at the start of an execute pass
+  std::uint64_t lock_failures = 0;    /// Times a producer or the consumer had to wait for one of the executor's locks
+  std::uint64_t execute_passes = 0;   /// Passes that started with queued tasks or pending timers
+  std::uint64_t blocked_enqueues = 0; /// Times a producer waited for room in the queue, see overflow_policy::BLOCK
+  std::uint64_t rejected_queries = 0; /// Async queries failed because the queue was full, see overflow_policy::FAIL_QUERIES
+  std::uint64_t dropped_tasks = 0;    /// Queued tasks discarded to get back under capacity, see overflow_policy::DROP_OLDEST
+  std::uint64_t dropped_events = 0;   /// Events discarded because the queue was full, see overflow_policy::DROP_EVENTS
+  std::uint64_t expired_requests = 0; /// Async requests failed without running the handler because their deadline had passed
+  std::uint64_t canceled_requests = 0; /// Async requests skipped because the caller's lifetime had ended, including compacted ones
+  std::uint64_t compacted_tasks = 0;  /// Canceled tasks removed from the queue before they were reached, see executor::compact
+  duration_histogram enqueue_to_execute; /// Sampled for one in `executor::latency_sample_interval` tasks
+  duration_histogram pass_duration;      /// Sampled for one in `executor::pass_sample_interval` passes
+};
+
+/// Histogram that one thread at a time records into while others take snapshots
+class duration_recorder {
+public:
+  void record(std::chrono::steady_clock::duration duration) {
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    std::size_t index = nanoseconds > 1 ? 63 - __builtin_clzll(static_cast<std::uint64_t>(nanoseconds)) : 0;
+
+    if (index >= duration_histogram::num_buckets)
+      index = duration_histogram::num_buckets - 1;
+
+    // Only one thread records at a time, so there's no need for a read-modify-write
+    buckets_[index].store(buckets_[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  duration_histogram snapshot() const {
+    duration_histogram histogram;
+
+    for (std::size_t i = 0; i < duration_histogram::num_buckets; ++i)
+      histogram.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+
+    return histogram;
+  }
+
+private:
+  std::atomic<std::uint64_t> buckets_[duration_histogram::num_buckets] = {};
+};
+
+}
+
+#endif // MINICOMPS_EXECUTOR_STATS_H_
@@ -3,15 +3,23 @@
 #ifndef MINICOMPS_FIXED_ANY_H_
 #define MINICOMPS_FIXED_ANY_H_
 
+#include <cassert>
 #include <cstddef>
-#include <functional>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
-#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace mc {
 
 /// Like `std::any` but you can customize the SBO storage size. Falls back to memory allocation if the storage
 /// is too small. No type checking, client needs to know that it's accessing the same type as was written.
+///
+/// The stored type's destructor and move constructor are reached through a static table per type, so the object
+/// only adds two pointers to the storage. Trivially copyable values are moved with memcpy.
 template<std::size_t Length>
 class fixed_any {
 public:
@@ -19,68 +27,61 @@ public:
   fixed_any(fixed_any<Length>&& other) {assign(std::move(other)); }
   ~fixed_any() {destroy(); }
 
+  fixed_any& operator =(fixed_any<Length>&& other) {return assign(std::move(other)); }
+
   fixed_any& assign(fixed_any<Length>&& other) {
+    if (this == &other)
+      return *this;
+
     destroy();
 
-    if (other.aligned_ptr_)
-      aligned_ptr_ = storage_ + other.aligned_diff(); // Diff is OK since the storage is max-aligned
-    else
-      aligned_ptr_ = nullptr;
+    if (!other.object_ptr_)
+      return *this;
 
-    object_ptr_ = other.move_construct_(aligned_ptr_, other.object_ptr_);
+    operations_ = other.operations_;
 
-    other.destroy();
+    if (operations_->on_heap) {
+      // Heap objects never move, we just take over the pointer
+      object_ptr_ = other.object_ptr_;
+    }
+    else {
+      // Same offset as in the other storage, which is OK since both are max-aligned
+      void* target = storage_ + (static_cast<char*>(other.object_ptr_) - other.storage_);
 
-    destruct_ = std::move(other.destruct_); // These aren't deleted by destroy, so is fine
-    move_construct_ = std::move(other.move_construct_);
+      if (operations_->relocate) {
+        object_ptr_ = operations_->relocate(target, other.object_ptr_);
+      }
+      else {
+        std::memcpy(target, other.object_ptr_, operations_->size);
+        object_ptr_ = target;
+      }
+    }
 
+    other.object_ptr_ = nullptr;
+    other.operations_ = nullptr;
     return *this;
   }
 
   template<typename T>
   fixed_any& assign(T&& value) {
+    using value_type = std::decay_t<T>;
     destroy();
 
-    if constexpr(sizeof(T) + alignof(T) - 1 <= sizeof(storage_)) {
+    if constexpr(sizeof(value_type) + alignof(value_type) - 1 <= sizeof(storage_)) {
       // We know for sure that there's space for the object and its alignment
-
-      {
-        void* aligned_ptr = storage_;
-        std::size_t used_storage = sizeof(storage_);
-        void* aligned = std::align(alignof(T), sizeof(T), aligned_ptr, used_storage);
-        assert(aligned && "aligned object goes out of bounds");
-        aligned_ptr_ = aligned_ptr;
-      }
-
-      object_ptr_ = new (aligned_ptr_) T(std::move(value));
-
-      destruct_ = [](void* ptr) {
-        check_alignment<T>(ptr);
-        static_cast<T*>(ptr)->~T();
-      };
-
-      move_construct_ = [](void* target, void* source) {
-        check_alignment<T>(target); // TODO: can be removed
-        check_alignment<T>(source);
-        return new (target) T(std::move(*static_cast<T*>(source)));
-      };
+      void* aligned_ptr = storage_;
+      std::size_t used_storage = sizeof(storage_);
+      void* aligned = std::align(alignof(value_type), sizeof(value_type), aligned_ptr, used_storage);
+      assert(aligned && "aligned object goes out of bounds");
+      (void)aligned;
+
+      object_ptr_ = new (aligned_ptr) value_type(std::forward<T>(value));
+      operations_ = &inline_operations<value_type>;
     }
     else {
       // We might not have enough space for the object, use heap allocation
-      // TODO: check if we really need heap allocation
-      aligned_ptr_ = nullptr;
-      object_ptr_ = new T(std::move(value));
-
-      destruct_ = [](void* ptr) {
-        check_alignment<T>(ptr);
-        delete static_cast<T*>(ptr);
-      };
-
-      move_construct_ = [](void* target, void* source) {
-        (void)target; // Not used -- we don't new in-place
-        check_alignment<T>(source);
-        return new T(std::move(*static_cast<T*>(source)));
-      };
+      object_ptr_ = new value_type(std::forward<T>(value));
+      operations_ = &heap_operations<value_type>;
     }
 
     return *this;
@@ -98,19 +99,58 @@ public:
     return object_ptr_;
   }
 
+  void reset() {
+    destroy();
+  }
+
 private:
+  struct operations {
+    void (*destruct)(void* object);               /// Null if there's nothing to destroy
+    void* (*relocate)(void* target, void* source); /// Moves to `target` and destroys the source. Null if memcpy will do
+    std::size_t size;
+    bool on_heap;
+  };
+
+  template<typename T>
+  static void destruct_inline(void* ptr) {
+    check_alignment<T>(ptr);
+    static_cast<T*>(ptr)->~T();
+  }
+
+  template<typename T>
+  static void* relocate_inline(void* target, void* source) {
+    check_alignment<T>(source);
+    T* moved = new (target) T(std::move(*static_cast<T*>(source)));
+    static_cast<T*>(source)->~T();
+    return moved;
+  }
+
+  template<typename T>
+  static void destruct_heap(void* ptr) {
+    check_alignment<T>(ptr);
+    delete static_cast<T*>(ptr);
+  }
+
+  template<typename T>
+  static constexpr operations inline_operations = {
+    std::is_trivially_destructible_v<T> ? nullptr : &destruct_inline<T>,
+    std::is_trivially_copyable_v<T> ? nullptr : &relocate_inline<T>,
+    sizeof(T),
+    false
+  };
+
+  template<typename T>
+  static constexpr operations heap_operations = {&destruct_heap<T>, nullptr, sizeof(T), true};
+
   void destroy() {
     if (!object_ptr_)
       return;
 
-    destruct_(object_ptr_);
-    object_ptr_ = nullptr;
-    aligned_ptr_ = nullptr;
-  }
+    if (operations_->destruct)
+      operations_->destruct(object_ptr_);
 
-  ptrdiff_t aligned_diff() const {
-    // Don't call this function if aligned_ptr_ is null
-    return static_cast<const char*>(aligned_ptr_) - storage_;
+    object_ptr_ = nullptr;
+    operations_ = nullptr;
   }
 
   template<typename T>
@@ -120,11 +160,8 @@ private:
   }
 
   alignas(alignof(std::max_align_t)) char storage_[Length];
-  void* aligned_ptr_ = nullptr;
   void* object_ptr_ = nullptr;
-
-  std::function<void(void*)> destruct_;
-  std::function<void*(void*, void*)> move_construct_;
+  const operations* operations_ = nullptr;
 };
 
 }
@@ -0,0 +1,61 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_GRACE_PERIOD_H_
+#define MINICOMPS_GRACE_PERIOD_H_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace mc {
+
+/// Lets readers use a shared structure while a writer replaces parts of it, without either side taking a lock.
+/// Readers wrap their accesses in a `reader_section`. A writer publishes the new version, calls `synchronize`, and
+/// can then free the old version, since every reader that could have seen it has left its section.
+///
+/// Entering and leaving a section is one atomic increment and decrement each, and never waits. `synchronize`
+/// waits for readers and must not be called from within a section, or by two writers at the same time.
+class grace_period {
+public:
+  class reader_section {
+  public:
+    explicit reader_section(grace_period& period)
+      : readers_(period.readers_[period.epoch_.load() & 1]) {
+      readers_.fetch_add(1);
+    }
+
+    ~reader_section() {
+      readers_.fetch_sub(1);
+    }
+
+    reader_section(const reader_section&) = delete;
+    reader_section& operator =(const reader_section&) = delete;
+
+  private:
+    std::atomic<std::uint64_t>& readers_;
+  };
+
+  /// Returns once every reader that entered its section before the call has left it
+  void synchronize() {
+    // Readers can enter with an epoch they loaded before we flipped it, so the old counter isn't guaranteed to
+    // stay drained. Flipping twice and draining both counters covers them, and new readers can't keep either
+    // counter busy since they go to the other one.
+    const std::uint64_t epoch = epoch_.fetch_add(1);
+    wait_until_drained(readers_[epoch & 1]);
+    epoch_.fetch_add(1);
+    wait_until_drained(readers_[(epoch + 1) & 1]);
+  }
+
+private:
+  static void wait_until_drained(const std::atomic<std::uint64_t>& readers) {
+    while (readers.load() != 0)
+      std::this_thread::yield();
+  }
+
+  std::atomic<std::uint64_t> epoch_{0};
+  std::atomic<std::uint64_t> readers_[2] = {};
+};
+
+}
+
+#endif // MINICOMPS_GRACE_PERIOD_H_
@@ -9,6 +9,8 @@
 #include <minicomps/callback.h>
 #include <minicomps/interface.h>
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <tuple>
 #include <iostream>
@@ -49,6 +51,7 @@ public:
     // We cache the pointers
     linked_handling_component_ = other.handling_component_.lock().get(); // TODO: check for null
     linked_executor_ = other.handling_executor_.lock().get();
+    linked_lane_ = other.request_lane_;
     msg_info_.name = other.name_;
 
     assert(linked_handling_component_);
@@ -69,7 +72,7 @@ public:
       {}
 
     ~query_invoker() {
-      if_async_query_.execute(std::move(callback_), std::move(lifetime_), std::move(arguments_));
+      if_async_query_.execute(std::move(callback_), std::move(lifetime_), deadline_, std::move(arguments_));
     }
 
     query_invoker&& with_lifetime(const lifetime& life) && {
@@ -77,6 +80,16 @@ public:
       return std::move(*this);
     }
 
+    /// Same as async_query's: a request still queued at `deadline` fails with `query_error::timed_out`
+    query_invoker&& with_deadline(std::chrono::steady_clock::time_point deadline) && {
+      deadline_ = deadline;
+      return std::move(*this);
+    }
+
+    query_invoker&& with_timeout(std::chrono::steady_clock::duration timeout) && {
+      return std::move(*this).with_deadline(std::chrono::steady_clock::now() + timeout);
+    }
+
     query_invoker&& with_callback(std::function<void(mc::concrete_result<return_type>&&)>&& callback) && {
       callback_ = std::move(callback);
       return std::move(*this);
@@ -99,6 +112,7 @@ public:
   private:
     if_async_query& if_async_query_;
     lifetime_weak_ptr lifetime_;
+    std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max();
     std::function<void(mc::concrete_result<return_type>&&)> callback_;
     std::tuple<ArgumentTypes...> arguments_;
     component* sender_;
@@ -117,17 +131,18 @@ public:
     return mc::coroutine<return_type>([this, copied_arguments = std::move(copied_arguments)](mc::promise<return_type>&& promise) mutable {
       execute([promise = std::move(promise)](mc::concrete_result<return_type>&& result) {
         promise(std::move(result));
-      }, sending_lifetime_, std::move(copied_arguments));
+      }, sending_lifetime_, std::chrono::steady_clock::time_point::max(), std::move(copied_arguments));
     });
   }
 
   /// Called by the handling component's publish function
   template<typename CallbackType>
-  void publish(CallbackType callback, std::weak_ptr<component>&& handling_component, std::weak_ptr<executor>&& executor) {
+  void publish(CallbackType callback, std::weak_ptr<component>&& handling_component, std::weak_ptr<executor>&& executor, lane request_lane = lane::NORMAL) {
     // TODO: check that we haven't already been published
     handler_ = std::move(callback);
     handling_component_ = std::move(handling_component);
     handling_executor_ = std::move(executor);
+    request_lane_ = request_lane;
   }
 
   template<typename CallbackType>
@@ -157,7 +172,7 @@ public:
 private:
   /// Called from the client component
   template<typename CallbackType>
-  void execute(CallbackType&& callback, lifetime_weak_ptr lifetime, std::tuple<ArgumentTypes...>&& arguments) {
+  void execute(CallbackType&& callback, lifetime_weak_ptr lifetime, std::chrono::steady_clock::time_point deadline, std::tuple<ArgumentTypes...>&& arguments) {
     if (!linked_query_)
       std::abort();
 
@@ -173,24 +188,46 @@ private:
       std::apply(linked_query_->handler_, std::tuple_cat(std::move(arguments), std::make_tuple(std::move(result_handler))));
     }
     else {
+      // Responses to requests in a lane above the response lane stay in that lane
+      const lane response_lane = std::min(linked_lane_, lane::RESPONSE);
+
+      if (!linked_executor_->admit(work_kind::REQUEST)) {
+        callback_result<return_type> result_handler{executor_ptr(sending_component_->default_executor), std::move(lifetime), sending_component_, linked_handling_component_, msg_info_, std::move(callback), response_lane};
+        result_handler(mc::failure(query_error::overloaded));
+        return;
+      }
+
       struct request_data {
         std::tuple<ArgumentTypes...> arguments;
         std::function<void(mc::concrete_result<return_type>&&)> callback;
         executor_ptr receiver_executor; // We have to capture executor as a shared_ptr to protect against lifetime issues
         lifetime_weak_ptr lifetime;
+        std::chrono::steady_clock::time_point deadline;
 
         // Fields used only for the listener
         component* receiver;
         component* sender;
+
+        /// Lets the executor throw the request away without running it once the caller has gone away
+        bool canceled() const {
+          return lifetime.expired();
+        }
       };
 
-      request_data request{std::move(arguments), std::move(callback), sending_component_->default_executor, std::move(lifetime), sending_component_, linked_handling_component_};
+      request_data request{std::move(arguments), std::move(callback), sending_component_->default_executor, std::move(lifetime), deadline, sending_component_, linked_handling_component_};
 
       // Note: handler as captured here could become a dangling pointer if the message handler is removed/replaced
-      auto request_task = [linked_query = linked_query_, msg_info = msg_info_] (void* data) {
+      auto request_task = [linked_query = linked_query_, msg_info = msg_info_, response_lane] (void* data) {
         request_data& request = *static_cast<request_data*>(data);
         // TODO: don't capture msg_info
 
+        if (request.canceled()) {
+          if (executor* current = executor::current())
+            current->count_canceled_request();
+
+          return;
+        }
+
         // The callback_result is the object that gets called by the application to return a value to the calling component. Sender and receiver
         // is only used by the listener.
         callback_result result_handler{
@@ -199,13 +236,19 @@ private:
           request.receiver,
           request.sender,
           msg_info,
-          std::move(request.callback)
+          std::move(request.callback),
+          response_lane
         };
 
+        if (request_expired(request.deadline)) {
+          result_handler(mc::failure(query_error::timed_out));
+          return;
+        }
+
         std::apply(linked_query->handler_, std::tuple_cat(std::move(request.arguments), std::make_tuple(std::move(result_handler))));
       };
 
-      linked_executor_->enqueue_work(std::move(request_task), std::move(request));
+      linked_executor_->enqueue_work(std::move(request_task), std::move(request), linked_lane_);
 
       if (linked_handling_component_->listener)
         linked_handling_component_->listener->on_enqueue(sending_component_, linked_handling_component_, msg_info_, message_type::REQUEST);
@@ -218,12 +261,14 @@ private:
   std::function<callback_inner_type> handler_;
   std::weak_ptr<component> handling_component_;
   std::weak_ptr<executor> handling_executor_;
+  lane request_lane_ = lane::NORMAL;
 
   // Fields set on the client side. These can be pointers since the broker will invalidate the receiver set
   // if the target goes out of scope, and it's impossible to unregister an interface.
   if_async_query* linked_query_ = nullptr;
   component* linked_handling_component_ = nullptr;
   executor* linked_executor_ = nullptr;
+  lane linked_lane_ = lane::NORMAL;
   lifetime_weak_ptr sending_lifetime_;
   component* sending_component_ = nullptr;
   message_info msg_info_; // TODO: storing message_info like this and passing it in callback handlers isn't safe!
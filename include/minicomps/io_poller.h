@@ -0,0 +1,91 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_IO_POLLER_H_
+#define MINICOMPS_IO_POLLER_H_
+
+#include <minicomps/lifetime.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace mc {
+
+/// Readiness callbacks for file descriptors, on top of an epoll set. The set also holds an eventfd that other
+/// threads can signal through `wake`, so a thread can wait for I/O and for wakeups in the same syscall.
+/// Watches are level-triggered, and a callback doesn't run once its lifetime has ended. Linux only; elsewhere,
+/// watching an fd fails.
+///
+/// Only `wake` is thread-safe.
+class io_poller {
+public:
+  io_poller();
+  ~io_poller();
+
+  io_poller(const io_poller&) = delete;
+  io_poller& operator =(const io_poller&) = delete;
+
+  /// Runs `callback(ready_events)` whenever `fd` is ready for any of `events` (EPOLLIN, EPOLLOUT, ...). Replaces
+  /// the fd's earlier watch, if any. Returns false if the fd can't be watched.
+  bool watch(int fd, std::uint32_t events, const lifetime& life, std::function<void(std::uint32_t)> callback);
+
+  /// Returns false if the fd wasn't watched. Unwatch fds before closing them; the kernel forgets about closed fds,
+  /// but the callback would be kept around.
+  bool unwatch(int fd);
+
+  /// Sleeps until a watched fd is ready, `wake` is called, or `timeout` has passed. Ready fds are remembered
+  /// for `run_ready`.
+  void wait(std::chrono::steady_clock::duration timeout);
+
+  /// Runs the callbacks of the fds that `wait` found ready, or of the ones that are ready right now if `wait`
+  /// didn't find any. Returns the number of callbacks that ran.
+  std::size_t run_ready();
+
+  /// Makes `wait` return. Can be called from any thread.
+  void wake();
+
+  /// Whether `wait` has found ready fds that haven't been handled yet
+  bool has_ready() const {
+    return next_ready_ != num_ready_;
+  }
+
+  std::size_t size() const {
+    return num_watches_;
+  }
+
+private:
+  struct watch_entry {
+    std::uint32_t serial; /// Tells events for an earlier watch of the same fd apart
+    lifetime_weak_ptr lifetime;
+    std::function<void(std::uint32_t)> callback;
+  };
+
+  static constexpr std::size_t max_events = 64;
+
+  /// Fetches ready events; a negative timeout waits forever
+  void poll(int timeout_ms);
+
+  int epoll_fd_ = -1;
+  int event_fd_ = -1;
+
+  // Callbacks can watch and unwatch fds, so the entry that is running is kept alive by a reference of its own
+  std::vector<std::shared_ptr<watch_entry>> watches_; // Indexed by fd
+  std::size_t num_watches_ = 0;
+  std::uint32_t next_serial_ = 0;
+
+  struct ready_event {
+    std::uint64_t data;
+    std::uint32_t events;
+  };
+
+  ready_event ready_[max_events];
+  std::size_t num_ready_ = 0;
+  std::size_t next_ready_ = 0;
+};
+
+}
+
+#endif // MINICOMPS_IO_POLLER_H_
@@ -8,6 +8,8 @@
 #include <minicoros/types.h>
 #include <minicoros/coroutine.h> // TODO: make it so we don't need this dependency
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <utility>
@@ -21,6 +23,26 @@ public:
   virtual ~message() = default;
 };
 
+/// Hands out message ids from one process-wide counter, starting at 1, so ids are small and dense enough to
+/// index arrays with. Lives in the library rather than in a header, so shared libraries agree on it.
+message_id allocate_message_id();
+
+/// Returns the id stored in `slot`, allocating it on first use. The slot is constant-initialized, so this works
+/// before static constructors have run and without thread-safe statics; threads racing for the first id agree
+/// on one of them and leave a gap in the sequence.
+inline message_id resolve_message_id(std::atomic<message_id>& slot) {
+  if (const message_id id = slot.load(std::memory_order_acquire))
+    return id;
+
+  message_id expected = 0;
+  const message_id allocated = allocate_message_id();
+
+  if (!slot.compare_exchange_strong(expected, allocated, std::memory_order_acq_rel))
+    return expected;
+
+  return allocated;
+}
+
 template<typename MessageType>
 message_id get_message_id() {
   return get_message_id(static_cast<MessageType*>(nullptr));
@@ -32,6 +54,27 @@ public:
   message_id id;
 };
 
+/// Errors that async queries fail with when the request never reached the handler. They're far from zero so they
+/// don't clash with the application's own error codes.
+namespace query_error {
+
+constexpr int overloaded = -10000; /// The receiver's executor was full, see overflow_policy::FAIL_QUERIES
+constexpr int timed_out = -10001;  /// The request's deadline passed while it was queued
+
+}
+
+/// Returns true, and counts it on the executor running the request, if a queued request's deadline has passed.
+/// Requests without a deadline don't look at the clock.
+inline bool request_expired(std::chrono::steady_clock::time_point deadline) {
+  if (deadline == std::chrono::steady_clock::time_point::max() || std::chrono::steady_clock::now() < deadline)
+    return false;
+
+  if (executor* current = executor::current())
+    current->count_expired_request();
+
+  return true;
+}
+
 template<typename T>
 struct signature_util;
 
@@ -114,15 +157,17 @@ const message_info& get_message_info() {
 
 #define MESSAGE_API  // dllexport/dllimport
 
+// The id slot is declared next to the message so get_message_id can be inlined, and defined once with the
+// message so every shared library sees the same id
 #define MESSAGE_DECLARATION(name)                                                           \
-  MESSAGE_API mc::message_id get_message_id(name*);                                         \
+  MESSAGE_API extern std::atomic<mc::message_id> minicomps_message_id_##name;               \
+  inline mc::message_id get_message_id(name*) {                                             \
+    return mc::resolve_message_id(minicomps_message_id_##name);                             \
+  }                                                                                         \
   MESSAGE_API const mc::message_info& get_message_info(name*);
 
 #define MESSAGE_DEFINITION(name)                                                            \
-  mc::message_id get_message_id(name*) {                                                    \
-    static int uniq;                                                                        \
-    return mc::message_id{reinterpret_cast<uintptr_t>(&uniq)};                              \
-  }                                                                                         \
+  std::atomic<mc::message_id> minicomps_message_id_##name{0};                               \
   const mc::message_info& get_message_info(name* ptr) {                                     \
     static mc::message_info msg{MINICOMPS_STR(name), get_message_id(ptr)};                            \
     return msg;                                                                             \
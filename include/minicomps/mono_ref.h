@@ -3,9 +3,12 @@
 #ifndef MINICOMPS_MONO_REF_H_
 #define MINICOMPS_MONO_REF_H_
 
+#include <minicomps/broker.h>
 #include <minicomps/component.h>
 #include <minicomps/messaging.h>
 
+#include <atomic>
+#include <cstdint>
 #include <tuple>
 #include <memory>
 
@@ -22,16 +25,20 @@ public:
 /// References a component's handler code for a specific MessageType. Expects only one
 /// handler to exist.
 /// Caches as much as possible of all indirections. Relies on the broker to tell us
-/// when a message handler has changed by expiring `receivers_`.
+/// when a message handler has changed by bumping the message's generation.
 ///
 /// For good performance, we cannot increment/decrement any ref counts on function invocation.
 template<typename MessageType, typename HandlerType, typename SubclassType>
 class mono_ref_base : public mono_ref {
+  static constexpr std::uint64_t unresolved = UINT64_MAX;
+
   HandlerType* handler_ = nullptr;
-  std::weak_ptr<message_receivers> receivers_;
+  const std::atomic<std::uint64_t>* generation_ = nullptr;
+  std::uint64_t resolved_generation_ = unresolved;
   bool same_executor_ = false;
   std::shared_ptr<component> receiver_;
   std::shared_ptr<executor> receiver_executor_;
+  lane receiver_lane_ = lane::NORMAL;
 
 public:
   mono_ref_base(broker& broker, component& component) : broker_(broker), component_(component) {}
@@ -39,38 +46,51 @@ public:
   using handler_type = HandlerType;
 
   HandlerType* lookup() {
-    // Check if we already have valid state for this handler or if we need to refetch
-    if (handler_ && !receivers_.expired())
+    // Check if we already have valid state for this handler or if we need to refetch. A cached miss (no
+    // receivers, or more than one) stays valid just as long
+    if (generation_ && generation_->load(std::memory_order_acquire) == resolved_generation_)
       return handler_;
 
     const message_id msg_id = get_message_id<MessageType>();
 
+    if (!generation_)
+      generation_ = &broker_.generation(msg_id);
+
+    handler_ = nullptr;
+    receiver_.reset();
+    resolved_generation_ = generation_->load(std::memory_order_acquire);
+
     // Find all components that are associated for this message id
-    receivers_ = broker_.lookup(msg_id);
-    auto receivers = receivers_.lock();
+    auto receivers = broker_.lookup(msg_id).lock();
 
-    if (!receivers) // No receivers
+    if (!receivers) // The list was replaced after we looked it up, so the generation has moved on
       return nullptr;
 
-    if (receivers->size() != 1) // Too many receivers -- we expect 1
+    if (receivers->size() != 1) // No receivers, or too many -- we expect 1
       return nullptr;
 
     receiver_ = (*receivers)[0].lock();
 
-    if (!receiver_) // Failed to lock; this might happen in races
+    if (!receiver_) { // Failed to lock; this might happen in races
+      resolved_generation_ = unresolved;
       return nullptr;
+    }
 
     SubclassType& subclass = *static_cast<SubclassType*>(this);
     handler_ = static_cast<HandlerType*>(subclass.lookup_handler(*receiver_.get(), msg_id));
 
-    if (!handler_) // Receiver possibly out of sync with the broker
+    if (!handler_) { // Receiver possibly out of sync with the broker
+      resolved_generation_ = unresolved;
       return nullptr;
+    }
 
     if (executor_ptr executor_override = receiver_->lookup_executor_override(msg_id))
       receiver_executor_ = std::move(executor_override);
     else
       receiver_executor_ = receiver_->default_executor;
 
+    receiver_lane_ = receiver_->lookup_lane(msg_id);
+
     // Save whether we're on the same executor. Useful for some optimizations (lock and queue elision)
     same_executor_ = component_.default_executor.get() == receiver_executor_.get();
 
@@ -79,7 +99,7 @@ public:
 
   virtual void reset() override {
     handler_ = nullptr;
-    receivers_.reset();
+    resolved_generation_ = unresolved;
     receiver_.reset();
     receiver_executor_.reset();
   }
@@ -114,6 +134,10 @@ public:
     return receiver_executor_;
   }
 
+  lane receiver_lane() const {
+    return receiver_lane_;
+  }
+
   std::shared_ptr<component>& receiver() {
     return receiver_;
   }
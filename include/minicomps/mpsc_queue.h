@@ -0,0 +1,318 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_MPSC_QUEUE_H_
+#define MINICOMPS_MPSC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+namespace mc {
+
+/// Multi-producer/single-consumer queue stored in a chain of fixed-size segments. Producers claim slots using a
+/// CAS on the tail position, so they never wait for each other or for the consumer. The producer that claims the
+/// last slot of a segment moves the tail on to the next one, linking in a new segment if there isn't one, so a queue
+/// that fills up keeps growing lock-free instead of spilling into a shared overflow. The consumer links drained
+/// segments back in after the tail, so the chain keeps its longest length and a warmed up queue doesn't allocate.
+/// Segments are only freed with the queue. FIFO order is kept per producer.
+///
+/// Based on the segmented queue in crossbeam (SegQueue).
+template<typename T>
+class mpsc_queue {
+public:
+  explicit mpsc_queue(std::size_t segment_capacity)
+    : capacity_(segment_capacity) {
+    assert(capacity_ >= 2 && capacity_ < offset_mask && "segment capacity must fit in the position's offset");
+
+    head_ = new segment(capacity_);
+    tail_segment_.store(head_, std::memory_order_relaxed);
+
+    // The queue alternates between two segments as long as the consumer keeps up
+    head_->next.store(new segment(capacity_), std::memory_order_relaxed);
+  }
+
+  mpsc_queue(const mpsc_queue&) = delete;
+  mpsc_queue& operator =(const mpsc_queue&) = delete;
+
+  ~mpsc_queue() {
+    consume([] (T&) {});
+
+    while (segment* current = head_) {
+      head_ = current->next.load(std::memory_order_relaxed);
+      delete current;
+    }
+  }
+
+  template<typename... ArgumentTypes>
+  void emplace(ArgumentTypes&&... arguments) {
+    const claimed_slots claimed = claim(1);
+    slot& item = claimed.target->slots[claimed.offset];
+
+    new (item.storage) T(std::forward<ArgumentTypes>(arguments)...);
+    item.state.store(slot_written, std::memory_order_release);
+  }
+
+  /// Enqueues `count` items, claiming their slots with one CAS per segment. `produce(index, emplace)` is called
+  /// for every index in order and has to call `emplace(arguments...)` exactly once. The items are enqueued in
+  /// order, and batches that fit in a segment don't get any other producer's items in between.
+  template<typename ProduceType>
+  void emplace_batch(std::size_t count, ProduceType&& produce) {
+    for (std::size_t first = 0; first < count; first += capacity_) {
+      const std::size_t num_items = std::min(capacity_, count - first);
+      const claimed_slots claimed = claim(num_items);
+
+      for (std::size_t i = 0; i < num_items; ++i) {
+        slot& item = claimed.target->slots[claimed.offset + i];
+
+        produce(first + i, [&] (auto&&... arguments) {
+          new (item.storage) T(std::forward<decltype(arguments)>(arguments)...);
+        });
+
+        item.state.store(slot_written, std::memory_order_release);
+      }
+    }
+  }
+
+  /// Calls `callback` for every item that was enqueued before the call. Items enqueued by the
+  /// callback are left for the next call. Only one thread can consume at a time.
+  template<typename CallbackType>
+  std::size_t consume(CallbackType&& callback) {
+    return consume(std::forward<CallbackType>(callback), [] {return false; });
+  }
+
+  /// Like `consume`, but stops early once `should_stop` returns true. Items that weren't consumed stay
+  /// in the queue, in order.
+  template<typename CallbackType, typename StopPredicateType>
+  std::size_t consume(CallbackType&& callback, StopPredicateType&& should_stop) {
+    const std::uint64_t end = linear(tail_position_.load(std::memory_order_acquire));
+    std::size_t consumed = 0;
+
+    while (linear_head() != end) {
+      if (head_offset_ == capacity_) {
+        advance_head();
+        continue;
+      }
+
+      slot& item = head_->slots[head_offset_];
+      const std::uint8_t state = item.state.load(std::memory_order_acquire);
+
+      if (state == slot_empty) // A producer has claimed the slot but not yet written to it
+        return consumed;
+
+      if (state == slot_written) {
+        if (should_stop())
+          return consumed;
+
+        callback(*item.get());
+        item.get()->~T();
+        ++consumed;
+      }
+
+      item.state.store(slot_empty, std::memory_order_relaxed);
+      ++head_offset_;
+    }
+
+    return consumed;
+  }
+
+  /// Destroys the items that `predicate` returns true for and keeps the rest in order. Only looks at items that
+  /// the consumer could take right now; whatever is still being written is left alone. Returns the number of
+  /// removed items. Only called by the consumer.
+  template<typename PredicateType>
+  std::size_t remove_if(PredicateType&& predicate) {
+    const std::uint64_t end = linear(tail_position_.load(std::memory_order_acquire));
+    std::size_t removed = 0;
+
+    segment* read_segment = head_;
+    std::size_t read_offset = head_offset_;
+    segment* write_segment = head_;
+    std::size_t write_offset = head_offset_;
+
+    // Kept items move towards the front. The slots they leave behind are skipped by the consumer.
+    for (std::uint64_t read_position = linear_head(); read_position != end; ++read_position, ++read_offset) {
+      if (read_offset == capacity_) {
+        read_segment = read_segment->next.load(std::memory_order_acquire);
+        read_offset = 0;
+      }
+
+      slot& item = read_segment->slots[read_offset];
+      const std::uint8_t state = item.state.load(std::memory_order_acquire);
+
+      if (state == slot_empty)
+        break;
+
+      if (state == slot_skipped)
+        continue;
+
+      if (predicate(*item.get())) {
+        item.get()->~T();
+        item.state.store(slot_skipped, std::memory_order_relaxed);
+        ++removed;
+        continue;
+      }
+
+      if (write_offset == capacity_) {
+        write_segment = write_segment->next.load(std::memory_order_relaxed);
+        write_offset = 0;
+      }
+
+      slot& destination = write_segment->slots[write_offset++];
+
+      if (&destination != &item) {
+        new (destination.storage) T(std::move(*item.get()));
+        destination.state.store(slot_written, std::memory_order_relaxed);
+        item.get()->~T();
+        item.state.store(slot_skipped, std::memory_order_relaxed);
+      }
+    }
+
+    return removed;
+  }
+
+  /// Only called by the consumer
+  bool empty() const {
+    return linear_head() == linear(tail_position_.load(std::memory_order_acquire));
+  }
+
+private:
+  static constexpr std::uint8_t slot_empty = 0;
+  static constexpr std::uint8_t slot_written = 1;
+  static constexpr std::uint8_t slot_skipped = 2; /// Left over when a batch didn't fit, or emptied by remove_if
+
+  /// Positions are the segment's sequence number in the upper half, and the offset within it in the lower
+  static constexpr int segment_shift = 32;
+  static constexpr std::uint64_t offset_mask = (std::uint64_t{1} << segment_shift) - 1;
+
+  struct slot {
+    std::atomic<std::uint8_t> state{slot_empty};
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T* get() {
+      return std::launder(reinterpret_cast<T*>(storage));
+    }
+  };
+
+  struct segment {
+    explicit segment(std::size_t capacity) : slots(new slot[capacity]) {}
+
+    const std::unique_ptr<slot[]> slots;
+    std::atomic<segment*> next{nullptr}; // Set before the tail moves on, and might already be set long before that
+  };
+
+  struct claimed_slots {
+    segment* target;
+    std::size_t offset;
+  };
+
+  /// Claims `count` consecutive slots in one segment. If they don't fit in what's left of the tail segment, the
+  /// rest of it is skipped.
+  claimed_slots claim(std::size_t count) {
+    std::uint64_t position = tail_position_.load(std::memory_order_acquire);
+
+    for (;;) {
+      const std::size_t offset = position & offset_mask;
+
+      // The producer that filled the tail segment is moving the tail on to the next one
+      if (offset == capacity_) {
+        std::this_thread::yield();
+        position = tail_position_.load(std::memory_order_acquire);
+        continue;
+      }
+
+      // Only the right segment if the CAS succeeds, as the tail segment changes only after the position has
+      segment* current = tail_segment_.load(std::memory_order_acquire);
+      const bool fits = offset + count <= capacity_;
+      const std::size_t taken = fits ? count : capacity_ - offset;
+
+      if (!tail_position_.compare_exchange_weak(position, position + taken, std::memory_order_acq_rel, std::memory_order_acquire))
+        continue;
+
+      if (offset + taken == capacity_) {
+        tail_segment_.store(next_segment(*current), std::memory_order_release);
+        tail_position_.store(((position >> segment_shift) + 1) << segment_shift, std::memory_order_release);
+      }
+
+      if (fits)
+        return {current, offset};
+
+      for (std::size_t i = offset; i < capacity_; ++i)
+        current->slots[i].state.store(slot_skipped, std::memory_order_release);
+
+      position = tail_position_.load(std::memory_order_acquire);
+    }
+  }
+
+  /// Called by the producer that filled `filled`. Usually the consumer has already linked in a drained segment.
+  segment* next_segment(segment& filled) {
+    segment* next = filled.next.load(std::memory_order_acquire);
+
+    if (next)
+      return next;
+
+    auto* created = new segment(capacity_);
+
+    // The consumer might be linking in a drained segment at the same time
+    if (filled.next.compare_exchange_strong(next, created, std::memory_order_acq_rel, std::memory_order_acquire))
+      return created;
+
+    delete created;
+    return next;
+  }
+
+  /// Links a drained segment in after the last one, so a producer can reuse it once the tail gets there
+  void recycle(segment* drained) {
+    drained->next.store(nullptr, std::memory_order_relaxed);
+
+    // Segments from the tail and on aren't drained, and this thread is the only one that recycles them
+    segment* last = tail_segment_.load(std::memory_order_acquire);
+
+    for (;;) {
+      segment* expected = nullptr;
+
+      if (last->next.compare_exchange_weak(expected, drained, std::memory_order_release, std::memory_order_acquire))
+        return;
+
+      if (expected)
+        last = expected;
+    }
+  }
+
+  void advance_head() {
+    segment* drained = head_;
+    head_ = drained->next.load(std::memory_order_acquire);
+    ++head_sequence_;
+    head_offset_ = 0;
+
+    // Slots were emptied as they were consumed
+    recycle(drained);
+  }
+
+  /// Positions as a number of slots, so that the end of a segment equals the start of the next
+  std::uint64_t linear(std::uint64_t position) const {
+    return (position >> segment_shift) * capacity_ + (position & offset_mask);
+  }
+
+  std::uint64_t linear_head() const {
+    return head_sequence_ * capacity_ + head_offset_;
+  }
+
+  const std::size_t capacity_;
+
+  alignas(64) std::atomic<std::uint64_t> tail_position_{0};
+  std::atomic<segment*> tail_segment_{nullptr};
+
+  // Only touched by the consumer
+  alignas(64) segment* head_ = nullptr;
+  std::uint64_t head_sequence_ = 0;
+  std::size_t head_offset_ = 0;
+};
+
+}
+
+#endif // MINICOMPS_MPSC_QUEUE_H_
@@ -3,9 +3,14 @@
 #ifndef MINICOMPS_POLY_REF_H_
 #define MINICOMPS_POLY_REF_H_
 
+#include <minicomps/broker.h>
 #include <minicomps/component.h>
 #include <minicomps/messaging.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
 #include <tuple>
 #include <memory>
 
@@ -31,10 +36,11 @@ public:
     handler_type* handler_ = nullptr;
 
   public:
-    receiver_handler(std::shared_ptr<component>&& component, handler_type* handler, bool same_executor)
+    receiver_handler(std::shared_ptr<component>&& component, handler_type* handler, bool same_executor, lane receiver_lane)
       : receiving_component_(std::move(component))
       , handler_(handler)
       , same_executor_(same_executor)
+      , receiver_lane_(receiver_lane)
       {}
 
     const std::shared_ptr<component>& receiver() const {
@@ -55,47 +61,77 @@ public:
       return handler_;
     }
 
+    lane receiver_lane() const {
+      return receiver_lane_;
+    }
+
+    /// Whether work for both receivers ends up in the same queue
+    bool shares_queue_with(const receiver_handler& other) const {
+      if (same_executor_ || other.same_executor_)
+        return same_executor_ == other.same_executor_;
+
+      return receiving_component_->default_executor == other.receiving_component_->default_executor && receiver_lane_ == other.receiver_lane_;
+    }
+
   private:
     std::shared_ptr<component> receiving_component_;
     bool same_executor_ = false;
+    lane receiver_lane_ = lane::NORMAL;
   };
 
   std::vector<receiver_handler>& lookup() {
-    // Check if we already have valid state for this handler or if we need to refetch
-    if (!receiver_handlers_.empty() && !receivers_.expired())
+    // Check if we already have valid state for this handler or if we need to refetch. An event without
+    // subscribers stays cached as an empty list
+    if (generation_ && generation_->load(std::memory_order_acquire) == resolved_generation_)
       return receiver_handlers_;
 
     const message_id msgId = get_message_id<MessageType>();
 
+    if (!generation_)
+      generation_ = &broker_.generation(msgId);
+
+    resolved_generation_ = generation_->load(std::memory_order_acquire);
+
     // Find all components that are associated for this message id
-    receivers_ = broker_.lookup(msgId);
-    auto receivers = receivers_.lock();
+    auto receivers = broker_.lookup(msgId).lock();
 
     receiver_handlers_.clear();
 
-    if (!receivers) // No receivers
+    if (!receivers) // The list was replaced after we looked it up, so the generation has moved on
       return receiver_handlers_;
 
     for (auto& r : *receivers) {
       auto receiver = r.lock();
-      if (!receiver) // Failed to lock; this might happen in races
+      if (!receiver) { // Failed to lock; this might happen in races
+        resolved_generation_ = unresolved;
         continue;
+      }
 
       handler_type* handler = static_cast<handler_type*>(receiver->lookup_async_handler(msgId));
-      if (!handler) // Receiver possibly out of sync with the broker
+      if (!handler) { // Receiver possibly out of sync with the broker
+        resolved_generation_ = unresolved;
         continue;
+      }
 
       // Save whether we're on the same executor. Useful for some optimizations (lock and queue elision)
       bool same_executor = receiver->default_executor.get() == component_.default_executor.get();
 
-      receiver_handlers_.emplace_back(std::move(receiver), handler, same_executor);
+      const lane receiver_lane = receiver->lookup_lane(msgId);
+      receiver_handlers_.emplace_back(std::move(receiver), handler, same_executor, receiver_lane);
+    }
+
+    // Receivers that share an executor and lane go next to each other, so events can be enqueued on them in one batch
+    for (auto iter = std::begin(receiver_handlers_); iter != std::end(receiver_handlers_); ++iter) {
+      std::stable_partition(std::next(iter), std::end(receiver_handlers_), [&] (const receiver_handler& other) {
+        return iter->shares_queue_with(other);
+      });
     }
 
     return receiver_handlers_;
   }
 
   virtual void reset() override {
-    receivers_.reset();
+    resolved_generation_ = unresolved;
     receiver_handlers_.clear();
   }
 
@@ -123,7 +159,10 @@ private:
   broker& broker_;
   component& component_;
 
-  std::weak_ptr<message_receivers> receivers_;
+  static constexpr std::uint64_t unresolved = UINT64_MAX;
+
+  const std::atomic<std::uint64_t>* generation_ = nullptr;
+  std::uint64_t resolved_generation_ = unresolved; // Lists with receivers we couldn't resolve are looked up again
   std::vector<receiver_handler> receiver_handlers_;
 };
 
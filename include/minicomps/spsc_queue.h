@@ -0,0 +1,240 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_SPSC_QUEUE_H_
+#define MINICOMPS_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace mc {
+
+/// Wait-free single-producer/single-consumer queue. Items are stored in a linked list of fixed-size
+/// blocks. Blocks that the consumer is done with are handed back to the producer, so memory is only
+/// allocated when the queue grows past its previous peak.
+///
+/// Inspired by cameron314/readerwriterqueue.
+template<typename T, std::size_t BlockSize = 128>
+class spsc_queue {
+public:
+  spsc_queue()
+    : tail_block_(new block)
+    , head_block_(tail_block_)
+    {}
+
+  spsc_queue(const spsc_queue&) = delete;
+  spsc_queue& operator =(const spsc_queue&) = delete;
+
+  ~spsc_queue() {
+    clear();
+
+    while (head_block_) {
+      block* next = head_block_->next.load(std::memory_order_relaxed);
+      delete head_block_;
+      head_block_ = next;
+    }
+
+    free_blocks(free_blocks_.exchange(nullptr, std::memory_order_acquire));
+    free_blocks(producer_free_blocks_);
+  }
+
+  /// Only called by the producer
+  template<typename... ArgumentTypes>
+  void emplace(ArgumentTypes&&... arguments) {
+    emplace_unpublished(std::forward<ArgumentTypes>(arguments)...);
+    publish(1);
+  }
+
+  /// Enqueues `count` items and publishes them to the consumer all at once. `produce(index, emplace)` is called
+  /// for every index in order and has to call `emplace(arguments...)` exactly once. Only called by the producer.
+  template<typename ProduceType>
+  void emplace_batch(std::size_t count, ProduceType&& produce) {
+    for (std::size_t i = 0; i < count; ++i) {
+      produce(i, [&] (auto&&... arguments) {
+        emplace_unpublished(std::forward<decltype(arguments)>(arguments)...);
+      });
+    }
+
+    publish(count);
+  }
+
+  /// Calls `callback` for every item that was enqueued before the call. Only called by the consumer.
+  template<typename CallbackType>
+  std::size_t consume(CallbackType&& callback) {
+    return consume(std::forward<CallbackType>(callback), [] {return false; });
+  }
+
+  /// Like `consume`, but stops early once `should_stop` returns true
+  template<typename CallbackType, typename StopPredicateType>
+  std::size_t consume(CallbackType&& callback, StopPredicateType&& should_stop) {
+    const std::size_t available = pushed_.load(std::memory_order_acquire) - popped_;
+    std::size_t consumed = 0;
+
+    while (consumed != available && !should_stop()) {
+      T* item = front();
+      callback(*item);
+      pop(item);
+      ++consumed;
+    }
+
+    return consumed;
+  }
+
+  /// Destroys the items that `predicate` returns true for and keeps the rest in order. Returns the number of
+  /// removed items. Only called by the consumer.
+  template<typename PredicateType>
+  std::size_t remove_if(PredicateType&& predicate) {
+    const std::size_t available = pushed_.load(std::memory_order_acquire) - popped_;
+
+    // Blocks are only linked forward, so we collect the items to be able to walk them backwards
+    items_.clear();
+    block* current = head_block_;
+    std::size_t index = head_index_;
+
+    for (std::size_t i = 0; i < available; ++i, ++index) {
+      if (index == BlockSize) {
+        current = current->next.load(std::memory_order_acquire);
+        index = 0;
+      }
+
+      items_.push_back(current->storage[index].data);
+    }
+
+    // Kept items move towards the back, so the emptied slots end up in front where the consumer starts
+    std::size_t write = available;
+    std::size_t removed = 0;
+
+    for (std::size_t read = available; read != 0;) {
+      --read;
+      T* item = std::launder(reinterpret_cast<T*>(items_[read]));
+
+      if (predicate(*item)) {
+        item->~T();
+        ++removed;
+        continue;
+      }
+
+      if (--write != read) {
+        new (items_[write]) T(std::move(*item));
+        item->~T();
+      }
+    }
+
+    for (std::size_t i = 0; i < write; ++i) {
+      front();
+      ++head_index_;
+      ++popped_;
+    }
+
+    return removed;
+  }
+
+  /// Destroys all items without invoking them. Only called by the consumer.
+  void clear() {
+    std::size_t available = pushed_.load(std::memory_order_acquire) - popped_;
+
+    while (available--)
+      pop(front());
+  }
+
+  /// Only called by the consumer
+  bool empty() const {
+    return pushed_.load(std::memory_order_acquire) == popped_;
+  }
+
+private:
+  struct slot {
+    alignas(T) unsigned char data[sizeof(T)];
+  };
+
+  struct block {
+    std::atomic<block*> next{nullptr};
+    block* next_free = nullptr;
+    slot storage[BlockSize];
+  };
+
+  template<typename... ArgumentTypes>
+  void emplace_unpublished(ArgumentTypes&&... arguments) {
+    if (tail_index_ == BlockSize) {
+      block* new_block = acquire_block();
+      tail_block_->next.store(new_block, std::memory_order_release);
+      tail_block_ = new_block;
+      tail_index_ = 0;
+    }
+
+    new (tail_block_->storage[tail_index_].data) T(std::forward<ArgumentTypes>(arguments)...);
+    ++tail_index_;
+  }
+
+  /// Publishes the items and the links to new blocks (if any)
+  void publish(std::size_t count) {
+    pushed_.store(pushed_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  T* front() {
+    if (head_index_ == BlockSize) {
+      // The producer has linked in a new block before publishing any item in it
+      block* next = head_block_->next.load(std::memory_order_acquire);
+      release_block(head_block_);
+      head_block_ = next;
+      head_index_ = 0;
+    }
+
+    return std::launder(reinterpret_cast<T*>(head_block_->storage[head_index_].data));
+  }
+
+  void pop(T* item) {
+    item->~T();
+    ++head_index_;
+    ++popped_;
+  }
+
+  /// Called by the consumer. The producer never touches a block after it has moved on to the next one
+  void release_block(block* released) {
+    released->next_free = free_blocks_.load(std::memory_order_relaxed);
+
+    while (!free_blocks_.compare_exchange_weak(released->next_free, released, std::memory_order_release, std::memory_order_relaxed)) {}
+  }
+
+  /// Called by the producer. Takes all blocks released by the consumer in one go, so there's no ABA problem.
+  block* acquire_block() {
+    if (!producer_free_blocks_)
+      producer_free_blocks_ = free_blocks_.exchange(nullptr, std::memory_order_acquire);
+
+    if (!producer_free_blocks_)
+      return new block;
+
+    block* reused = producer_free_blocks_;
+    producer_free_blocks_ = reused->next_free;
+    reused->next.store(nullptr, std::memory_order_relaxed);
+    return reused;
+  }
+
+  static void free_blocks(block* first) {
+    while (first) {
+      block* next = first->next_free;
+      delete first;
+      first = next;
+    }
+  }
+
+  // Producer state
+  alignas(64) block* tail_block_;
+  std::size_t tail_index_ = 0;
+  block* producer_free_blocks_ = nullptr;
+  std::atomic<std::size_t> pushed_{0};
+
+  // Consumer state
+  alignas(64) block* head_block_;
+  std::size_t head_index_ = 0;
+  std::size_t popped_ = 0;
+  std::vector<unsigned char*> items_; // Scratch space for remove_if
+
+  alignas(64) std::atomic<block*> free_blocks_{nullptr};
+};
+
+}
+
+#endif // MINICOMPS_SPSC_QUEUE_H_
@@ -0,0 +1,196 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_TASK_H_
+#define MINICOMPS_TASK_H_
+
+#include <minicomps/task_pool.h>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace mc {
+
+/// A unit of work for an executor: one function pointer followed by the callback and its data, stored inline
+/// in two cache lines. Callbacks whose data doesn't fit inline are stored in a block from `pool`, or on the heap
+/// if there's no pool.
+///
+/// The callback is called with a pointer to the data, and both are destroyed right after the call. If the data
+/// has a `bool canceled() const` member, the executor can ask for it and discard the task without running it.
+class alignas(64) task {
+public:
+  static constexpr std::size_t inline_capacity = 112;
+
+  template<typename CallbackType, typename DataType>
+  task(CallbackType&& callback, DataType&& data, task_pool* pool = nullptr) {
+    using bound_type = bound_task<std::decay_t<CallbackType>, std::decay_t<DataType>>;
+
+    if constexpr (alignof(bound_type) > alignof(std::max_align_t)) {
+      new (storage_) heap_storage<bound_type>{new bound_type{std::forward<CallbackType>(callback), std::forward<DataType>(data)}, nullptr};
+      operation_ = &heap_operation<bound_type>;
+    }
+    else if constexpr (sizeof(bound_type) <= inline_capacity) {
+      new (storage_) bound_type{std::forward<CallbackType>(callback), std::forward<DataType>(data)};
+      operation_ = &inline_operation<bound_type>;
+    }
+    else {
+      void* block = pool ? pool->allocate(sizeof(bound_type)) : ::operator new(sizeof(bound_type));
+      new (storage_) heap_storage<bound_type>{new (block) bound_type{std::forward<CallbackType>(callback), std::forward<DataType>(data)}, pool};
+      operation_ = &heap_operation<bound_type>;
+    }
+  }
+
+  task(task&& other) : operation_(other.operation_) {
+    if (operation_)
+      operation_(operation_type::MOVE, other.storage_, storage_);
+
+    other.operation_ = nullptr;
+  }
+
+  task& operator =(task&& other) {
+    if (this == &other)
+      return *this;
+
+    destroy();
+    operation_ = other.operation_;
+
+    if (operation_)
+      operation_(operation_type::MOVE, other.storage_, storage_);
+
+    other.operation_ = nullptr;
+    return *this;
+  }
+
+  task(const task&) = delete;
+  task& operator =(const task&) = delete;
+
+  ~task() {
+    destroy();
+  }
+
+  /// Runs and destroys the callback. Can only be called once.
+  void execute() {
+    operation_type_fn operation = operation_;
+    operation_ = nullptr;
+    operation(operation_type::RUN, storage_, nullptr);
+  }
+
+  /// Whether the task's data says that it doesn't have to run anymore
+  bool canceled() const {
+    bool result = false;
+    operation_(operation_type::CANCELED, const_cast<unsigned char*>(storage_), reinterpret_cast<unsigned char*>(&result));
+    return result;
+  }
+
+private:
+  enum class operation_type {
+    RUN,     /// Run, then destroy
+    DESTROY,
+    MOVE,    /// Move-construct into the target storage, then destroy the source
+    CANCELED /// Write whether the data has been canceled to the bool at target
+  };
+
+  using operation_type_fn = void(*)(operation_type, unsigned char* storage, unsigned char* target);
+
+  template<typename DataType, typename = void>
+  struct is_cancelable : std::false_type {};
+
+  template<typename DataType>
+  struct is_cancelable<DataType, std::void_t<decltype(std::declval<const DataType&>().canceled())>> : std::true_type {};
+
+  template<typename CallbackType, typename DataType>
+  struct bound_task {
+    CallbackType callback;
+    DataType data;
+
+    bool canceled() const {
+      if constexpr (is_cancelable<DataType>::value)
+        return data.canceled();
+      else
+        return false;
+    }
+  };
+
+  template<typename BoundType>
+  static void inline_operation(operation_type operation, unsigned char* storage, unsigned char* target) {
+    BoundType& bound = *std::launder(reinterpret_cast<BoundType*>(storage));
+
+    switch (operation) {
+    case operation_type::RUN:
+      bound.callback(static_cast<void*>(&bound.data));
+      bound.~BoundType();
+      break;
+
+    case operation_type::DESTROY:
+      bound.~BoundType();
+      break;
+
+    case operation_type::MOVE:
+      new (target) BoundType(std::move(bound));
+      bound.~BoundType();
+      break;
+
+    case operation_type::CANCELED:
+      *reinterpret_cast<bool*>(target) = bound.canceled();
+      break;
+    }
+  }
+
+  template<typename BoundType>
+  struct heap_storage {
+    BoundType* bound;
+    task_pool* pool; /// Null if the bound task was allocated with new
+  };
+
+  template<typename BoundType>
+  static void heap_operation(operation_type operation, unsigned char* storage, unsigned char* target) {
+    heap_storage<BoundType>& heap = *std::launder(reinterpret_cast<heap_storage<BoundType>*>(storage));
+
+    switch (operation) {
+    case operation_type::RUN:
+      heap.bound->callback(static_cast<void*>(&heap.bound->data));
+      release(heap);
+      break;
+
+    case operation_type::DESTROY:
+      release(heap);
+      break;
+
+    case operation_type::MOVE:
+      new (target) heap_storage<BoundType>(heap);
+      break;
+
+    case operation_type::CANCELED:
+      *reinterpret_cast<bool*>(target) = heap.bound->canceled();
+      break;
+    }
+  }
+
+  template<typename BoundType>
+  static void release(heap_storage<BoundType>& heap) {
+    if (!heap.pool) {
+      delete heap.bound;
+      return;
+    }
+
+    heap.bound->~BoundType();
+    heap.pool->deallocate(heap.bound, sizeof(BoundType));
+  }
+
+  void destroy() {
+    if (operation_) {
+      operation_(operation_type::DESTROY, storage_, nullptr);
+      operation_ = nullptr;
+    }
+  }
+
+  operation_type_fn operation_ = nullptr;
+  alignas(std::max_align_t) unsigned char storage_[inline_capacity];
+};
+
+static_assert(sizeof(task) == 128, "tasks should fill exactly two cache lines");
+
+}
+
+#endif // MINICOMPS_TASK_H_
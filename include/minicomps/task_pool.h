@@ -0,0 +1,57 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_TASK_POOL_H_
+#define MINICOMPS_TASK_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace mc {
+
+/// Recycles storage for tasks that are too large to be stored inline. Blocks are sorted into power-of-two size
+/// classes and kept on a free list per class once their task has run, so an executor stops allocating once it
+/// has seen its peak number of large tasks. Blocks larger than the biggest class go straight to the heap.
+///
+/// Any thread can allocate and deallocate. Deallocation is lock-free; allocating threads take turns, which
+/// keeps the free lists safe from the ABA problem.
+class task_pool {
+public:
+  static constexpr std::size_t min_block_size = 128;
+  static constexpr std::size_t num_size_classes = 6; // Up to 4 KiB
+
+  task_pool() = default;
+  task_pool(const task_pool&) = delete;
+  task_pool& operator =(const task_pool&) = delete;
+  ~task_pool();
+
+  /// Returns storage aligned for std::max_align_t
+  void* allocate(std::size_t size);
+  void deallocate(void* block, std::size_t size);
+
+  /// Number of blocks handed out so far, ie; tasks that didn't fit inline
+  std::uint64_t num_allocations() const {
+    return num_allocations_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct free_block {
+    free_block* next;
+  };
+
+  struct size_class {
+    std::atomic<free_block*> free_blocks{nullptr};
+    std::mutex allocate_mutex;
+  };
+
+  /// Returns num_size_classes if the block is too large to be pooled
+  static std::size_t size_class_index(std::size_t size);
+
+  size_class size_classes_[num_size_classes];
+  std::atomic<std::uint64_t> num_allocations_{0};
+};
+
+}
+
+#endif // MINICOMPS_TASK_POOL_H_
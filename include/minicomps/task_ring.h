@@ -0,0 +1,214 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_TASK_RING_H_
+#define MINICOMPS_TASK_RING_H_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace mc {
+
+/// Single-threaded FIFO stored in a linked list of fixed-size chunks. Items only move if `remove_if` closes a gap,
+/// all of the items in another ring can be appended in O(1), and drained chunks are kept for reuse so memory is
+/// only allocated when the ring grows past its previous peak.
+template<typename T, std::size_t ChunkSize = 64>
+class task_ring {
+public:
+  task_ring() = default;
+  task_ring(const task_ring&) = delete;
+  task_ring& operator =(const task_ring&) = delete;
+
+  ~task_ring() {
+    clear();
+    free_chunks(head_);
+    free_chunks(spare_chunks_);
+  }
+
+  template<typename... ArgumentTypes>
+  void emplace_back(ArgumentTypes&&... arguments) {
+    if (!tail_ || tail_->end == ChunkSize)
+      append_chunk();
+
+    new (tail_->slots[tail_->end].data) T(std::forward<ArgumentTypes>(arguments)...);
+    ++tail_->end;
+    ++size_;
+  }
+
+  T& front() {
+    return *head_->get(head_->begin);
+  }
+
+  void pop_front() {
+    head_->get(head_->begin)->~T();
+    ++head_->begin;
+    --size_;
+
+    if (head_->begin == head_->end)
+      release_head();
+  }
+
+  /// Destroys the items that `predicate` returns true for and moves the rest forward, keeping their order.
+  /// Returns the number of removed items.
+  template<typename PredicateType>
+  std::size_t remove_if(PredicateType&& predicate) {
+    if (empty())
+      return 0;
+
+    chunk* write_chunk = head_;
+    std::size_t write_index = head_->begin;
+    std::size_t kept = 0;
+
+    for (chunk* read_chunk = head_; read_chunk; read_chunk = read_chunk->next) {
+      for (std::size_t read_index = read_chunk->begin; read_index != read_chunk->end; ++read_index) {
+        T* item = read_chunk->get(read_index);
+
+        if (predicate(*item)) {
+          item->~T();
+          continue;
+        }
+
+        // Spliced rings leave partly filled chunks in the middle, but the reader is past the chunk we're leaving,
+        // so it can be filled up completely and the next one from its first slot
+        if (write_index == ChunkSize) {
+          write_chunk->end = ChunkSize;
+          write_chunk = write_chunk->next;
+          write_chunk->begin = write_index = 0;
+        }
+
+        if (write_chunk != read_chunk || write_index != read_index) {
+          new (write_chunk->slots[write_index].data) T(std::move(*item));
+          item->~T();
+        }
+
+        ++write_index;
+        ++kept;
+      }
+    }
+
+    const std::size_t removed = size_ - kept;
+    size_ = kept;
+
+    if (kept == 0) {
+      while (head_)
+        release_head();
+
+      return removed;
+    }
+
+    // Chunks after the last kept item are spare now
+    write_chunk->end = write_index;
+
+    while (chunk* unused = write_chunk->next) {
+      write_chunk->next = unused->next;
+      unused->next = spare_chunks_;
+      spare_chunks_ = unused;
+    }
+
+    tail_ = write_chunk;
+    return removed;
+  }
+
+  /// Moves every item in `other` to the back of this ring, keeping their order
+  void splice(task_ring& other) {
+    if (other.empty())
+      return;
+
+    // Our last chunk won't be written to again, the new items go after it
+    if (tail_)
+      tail_->next = other.head_;
+    else
+      head_ = other.head_;
+
+    tail_ = other.tail_;
+    size_ += other.size_;
+
+    other.head_ = other.tail_ = nullptr;
+    other.size_ = 0;
+  }
+
+  /// Takes the chunks that `other` has drained, so that this ring can reuse them
+  void take_spare_chunks(task_ring& other) {
+    while (chunk* spare = other.spare_chunks_) {
+      other.spare_chunks_ = spare->next;
+      spare->next = spare_chunks_;
+      spare_chunks_ = spare;
+    }
+  }
+
+  void clear() {
+    while (!empty())
+      pop_front();
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+
+private:
+  struct slot {
+    alignas(T) unsigned char data[sizeof(T)];
+  };
+
+  struct chunk {
+    slot slots[ChunkSize];
+    chunk* next = nullptr;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+
+    T* get(std::size_t index) {
+      return std::launder(reinterpret_cast<T*>(slots[index].data));
+    }
+  };
+
+  void append_chunk() {
+    chunk* new_chunk = spare_chunks_;
+
+    if (new_chunk)
+      spare_chunks_ = new_chunk->next;
+    else
+      new_chunk = new chunk;
+
+    new_chunk->next = nullptr;
+    new_chunk->begin = new_chunk->end = 0;
+
+    if (tail_)
+      tail_->next = new_chunk;
+    else
+      head_ = new_chunk;
+
+    tail_ = new_chunk;
+  }
+
+  void release_head() {
+    chunk* released = head_;
+    head_ = released->next;
+
+    if (released == tail_)
+      tail_ = nullptr;
+
+    released->next = spare_chunks_;
+    spare_chunks_ = released;
+  }
+
+  static void free_chunks(chunk* first) {
+    while (first) {
+      chunk* next = first->next;
+      delete first;
+      first = next;
+    }
+  }
+
+  chunk* head_ = nullptr;
+  chunk* tail_ = nullptr;
+  chunk* spare_chunks_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+}
+
+#endif // MINICOMPS_TASK_RING_H_
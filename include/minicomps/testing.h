@@ -9,6 +9,7 @@
 #include <vector>
 #include <iostream>
 #include <chrono>
+#include <initializer_list>
 
 namespace mc {
 
@@ -60,6 +61,27 @@ int measure_with_allocs(CallbackType&& callback) {
   return duration;
 }
 
+/// Like measure_with_allocs, but also reports the counters of the given executors
+template<typename CallbackType>
+int measure_with_allocs(CallbackType&& callback, std::initializer_list<executor_ptr> executors) {
+  const int duration = measure_with_allocs(std::forward<CallbackType>(callback));
+  std::size_t index = 0;
+
+  for (const executor_ptr& exec : executors) {
+    const executor_stats stats = exec->stats();
+
+    std::cout << "  Executor " << index++ << ": "
+              << stats.executed_tasks << "/" << stats.enqueued_tasks << " tasks executed, "
+              << "peak depth " << stats.peak_queue_depth << ", "
+              << stats.lock_failures << " lock failures, "
+              << stats.execute_passes << " passes (p50 " << stats.pass_duration.percentile(0.5).count() << " ns), "
+              << "latency p50 " << stats.enqueue_to_execute.percentile(0.5).count() << " ns, "
+              << "p99 " << stats.enqueue_to_execute.percentile(0.99).count() << " ns" << std::endl;
+  }
+
+  return duration;
+}
+
 }
 
 #endif // MINICOMPS_TESTING_H
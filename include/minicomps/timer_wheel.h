@@ -0,0 +1,133 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_TIMER_WHEEL_H_
+#define MINICOMPS_TIMER_WHEEL_H_
+
+#include <minicomps/fixed_any.h>
+#include <minicomps/lifetime.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mc {
+
+/// Refers to a scheduled timer. It's safe to cancel a timer through its handle after it has fired.
+struct timer_handle {
+  std::uint32_t index = UINT32_MAX;
+  std::uint32_t generation = 0;
+};
+
+/// Hierarchical timer wheel (Varghese & Lauck). Scheduling and canceling are O(1). Timers live in nodes that are
+/// reused, so scheduling doesn't allocate once the wheel has reached its peak number of timers (as long as the
+/// callback fits in the node's inline storage). A timer doesn't fire if its lifetime has ended.
+///
+/// Not thread-safe.
+class timer_wheel {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit timer_wheel(clock::duration resolution = std::chrono::milliseconds(1), clock::time_point start = clock::now());
+
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator =(const timer_wheel&) = delete;
+
+  /// Schedules `callback` to run once `delay` has passed, and then every `period` unless it's zero
+  template<typename CallbackType>
+  timer_handle schedule(clock::time_point now, clock::duration delay, clock::duration period, const lifetime& life, CallbackType callback) {
+    const std::uint32_t index = allocate_node();
+    node& timer = get_node(index);
+
+    timer.callback.assign(std::move(callback));
+    timer.invoke = [] (void* callable) {(*static_cast<CallbackType*>(callable))(); };
+    timer.lifetime = life.create_weak_ptr();
+    timer.expires = std::max(ticks_until(now + delay), current_tick_ + 1);
+    timer.period = period > clock::duration::zero() ? std::max<std::uint64_t>(ticks_until(start_ + period), 1) : 0;
+    timer.state = node_state::SCHEDULED;
+    insert(index);
+
+    return {index, timer.generation};
+  }
+
+  /// Returns false if the timer has already fired (and isn't periodic) or has been canceled
+  bool cancel(timer_handle handle);
+
+  /// Runs the timers that have expired at `now`. Returns the number of callbacks that ran.
+  std::size_t advance(clock::time_point now);
+
+  /// The next time that `advance` has something to do, or clock::time_point::max() if there are no timers
+  clock::time_point next_deadline() const;
+
+  std::size_t size() const {
+    return num_timers_;
+  }
+
+private:
+  static constexpr std::uint32_t nil = UINT32_MAX;
+  static constexpr std::size_t slot_bits = 6;
+  static constexpr std::size_t num_slots = 1 << slot_bits;
+  static constexpr std::uint64_t slot_mask = num_slots - 1;
+  static constexpr std::size_t num_levels = 4;
+  static constexpr std::size_t nodes_per_chunk = 64;
+
+  enum class node_state : std::uint8_t {
+    FREE,
+    SCHEDULED,
+    RUNNING,
+    CANCELED_WHILE_RUNNING
+  };
+
+  struct node {
+    std::uint32_t prev = nil;
+    std::uint32_t next = nil; // Also links the free list
+    std::uint32_t generation = 0;
+    std::uint16_t list = 0;
+    node_state state = node_state::FREE;
+    std::uint64_t expires = 0;
+    std::uint64_t period = 0;
+    lifetime_weak_ptr lifetime;
+    fixed_any<48> callback;
+    void (*invoke)(void*) = nullptr;
+  };
+
+  /// Nodes are allocated in chunks so that they don't move when the wheel grows, which can happen while a
+  /// callback is running
+  node& get_node(std::uint32_t index) {
+    return chunks_[index / nodes_per_chunk][index % nodes_per_chunk];
+  }
+
+  std::uint64_t ticks_until(clock::time_point time) const {
+    if (time <= start_)
+      return 0;
+
+    return static_cast<std::uint64_t>((time - start_ + resolution_ - clock::duration(1)) / resolution_);
+  }
+
+  std::uint64_t next_interesting_tick() const;
+  std::uint32_t allocate_node();
+  void free_node(std::uint32_t index);
+  void insert(std::uint32_t index);
+  void link(std::uint32_t index, std::uint16_t list);
+  void unlink(std::uint32_t index);
+  void cascade();
+  std::size_t fire_slot(std::uint16_t list);
+
+  const clock::duration resolution_;
+  const clock::time_point start_;
+  std::uint64_t current_tick_ = 0; // Every tick up to and including this one has been processed
+  std::size_t num_timers_ = 0;
+
+  std::uint32_t heads_[num_levels * num_slots];
+  std::uint32_t tails_[num_levels * num_slots];
+  std::uint64_t occupied_[num_levels] = {};
+
+  std::vector<std::unique_ptr<node[]>> chunks_;
+  std::uint32_t free_nodes_ = nil;
+};
+
+}
+
+#endif // MINICOMPS_TIMER_WHEEL_H_
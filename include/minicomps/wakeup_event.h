@@ -0,0 +1,47 @@
+/// Copyright 2022 Peter Backman
+
+#ifndef MINICOMPS_WAKEUP_EVENT_H_
+#define MINICOMPS_WAKEUP_EVENT_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if !defined(__linux__)
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace mc {
+
+/// Lets threads sleep until another thread signals them. Uses a futex on Linux and falls back to a
+/// condition variable elsewhere.
+///
+/// To avoid lost wakeups, the waiter calls `prepare` before its last check of the condition it's waiting
+/// for, and then passes the returned value to `wait`. If `signal` is called in between, `wait` returns
+/// immediately.
+class wakeup_event {
+public:
+  std::uint32_t prepare() const {
+    return epoch_.load(std::memory_order_acquire);
+  }
+
+  /// Returns when signaled, when the timeout expires, or spuriously
+  void wait(std::uint32_t epoch, std::chrono::steady_clock::duration timeout);
+  void signal();
+
+  /// Wakes every waiting thread instead of just one
+  void signal_all();
+
+private:
+  std::atomic<std::uint32_t> epoch_{0};
+
+#if !defined(__linux__)
+  std::mutex mutex_;
+  std::condition_variable cv_;
+#endif
+};
+
+}
+
+#endif // MINICOMPS_WAKEUP_EVENT_H_
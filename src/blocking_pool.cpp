@@ -0,0 +1,46 @@
+/// Copyright 2022 Peter Backman
+
+#include <minicomps/blocking_pool.h>
+
+namespace mc {
+
+blocking_pool::blocking_pool(std::size_t num_workers, std::size_t max_queued)
+  : max_queued_(max_queued) {
+  workers_.reserve(num_workers);
+
+  for (std::size_t i = 0; i < num_workers; ++i)
+    workers_.emplace_back([this] {run_worker(); });
+}
+
+blocking_pool::~blocking_pool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+
+  work_available_.notify_all();
+
+  for (std::thread& worker : workers_)
+    worker.join();
+
+  jobs_.clear();
+}
+
+void blocking_pool::run_worker() {
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_available_.wait(lock, [this] {return stopping_ || !jobs_.empty(); });
+
+    // Jobs can block for a long time, so we don't wait for the queued ones when shutting down
+    if (stopping_)
+      return;
+
+    task job(std::move(jobs_.front()));
+    jobs_.pop_front();
+    lock.unlock();
+
+    job.execute();
+  }
+}
+
+}
@@ -1,36 +1,262 @@
 /// Copyright 2022 Peter Backman
 
 #include <minicomps/broker.h>
+
+#include <algorithm>
 #include <iostream>
 
 namespace mc {
 
+broker::broker(std::size_t num_shards) {
+  while ((std::size_t{1} << shard_bits_) < num_shards)
+    ++shard_bits_;
+
+  const std::size_t rounded_shards = std::size_t{1} << shard_bits_;
+  shards_.reserve(rounded_shards);
+
+  for (std::size_t i = 0; i < rounded_shards; ++i) {
+    auto& new_shard = shards_.emplace_back(new shard);
+    new_shard->table = new lookup_table(64);
+  }
+}
+
+broker::broker(broker& parent, std::size_t num_shards)
+  : broker(num_shards) {
+  parent_ = &parent;
+
+  std::lock_guard<std::mutex> lock(parent.children_mutex_);
+  parent.children_.push_back(this);
+}
+
+broker::~broker() {
+  if (parent_) {
+    std::lock_guard<std::mutex> lock(parent_->children_mutex_);
+    auto& siblings = parent_->children_;
+    siblings.erase(std::remove(std::begin(siblings), std::end(siblings), this), std::end(siblings));
+  }
+
+  for (auto& current : shards_) {
+    reclaim(*current);
+
+    for (auto& entry : current->entries)
+      delete entry->receivers.load();
+
+    delete current->table.load();
+    delete current->sparse.load();
+  }
+}
+
 void broker::associate(message_id msg_id, std::weak_ptr<component> comp) {
-  std::lock_guard<std::recursive_mutex> lock(lookup_mutex_);
-  auto iter = active_lookups_.find(msg_id);
-  if (iter == std::end(active_lookups_)) {
-    message_receivers receivers;
-    receivers.push_back(comp);
-    active_lookups_[msg_id] = std::make_shared<message_receivers>(std::move(receivers));
-    return;
+  {
+    shard& target = shard_for(msg_id);
+    std::lock_guard<std::mutex> lock(target.write_mutex);
+    lookup_entry& entry = entry_for(target, msg_id);
+
+    // There might already be other handlers of this message, add us to the list after invalidating the old reference
+    entry.local.push_back(comp);
+    publish(target, msg_id, entry);
+    reclaim(target);
+  }
+
+  if (auto comp_sp = comp.lock()) {
+    std::lock_guard<std::mutex> lock(associations_mutex_);
+    std::vector<message_id>& msg_ids = associations_[comp_sp.get()];
+
+    if (std::find(std::begin(msg_ids), std::end(msg_ids), msg_id) == std::end(msg_ids))
+      msg_ids.push_back(msg_id);
   }
 
-  // There are already other handlers of this message, add us to the list after invalidating the old reference
-  message_receivers receivers = *iter->second; // NOTE! This copy preserves immutability
-  receivers.push_back(comp);
-  iter->second = std::make_shared<message_receivers>(std::move(receivers));
+  notify_children(&msg_id, 1);
 }
 
 void broker::disassociate(message_id msg_id, component* comp) {
-  std::lock_guard<std::recursive_mutex> lock(lookup_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(associations_mutex_);
 
-  auto iter = active_lookups_.find(msg_id);
-  if (iter == std::end(active_lookups_)) {
-    std::abort();
-    return;
+    auto assoc_iter = associations_.find(comp);
+    if (assoc_iter == std::end(associations_))
+      return;
+
+    std::vector<message_id>& msg_ids = assoc_iter->second;
+    auto id_iter = std::find(std::begin(msg_ids), std::end(msg_ids), msg_id);
+    if (id_iter == std::end(msg_ids))
+      return;
+
+    msg_ids.erase(id_iter);
+
+    if (msg_ids.empty())
+      associations_.erase(assoc_iter);
+  }
+
+  {
+    shard& target = shard_for(msg_id);
+    std::lock_guard<std::mutex> lock(target.write_mutex);
+    lookup_entry* entry = find_entry(target, msg_id);
+    if (!entry)
+      return;
+
+    remove_receiver(*entry, comp);
+    publish(target, msg_id, *entry);
+    reclaim(target);
+  }
+
+  notify_children(&msg_id, 1);
+}
+
+void broker::invalidate(message_id msg_id) {
+  {
+    shard& target = shard_for(msg_id);
+    std::lock_guard<std::mutex> lock(target.write_mutex);
+    lookup_entry* entry = find_entry(target, msg_id);
+    if (!entry)
+      return;
+
+    publish(target, msg_id, *entry);
+    reclaim(target);
   }
 
-  message_receivers receivers = *iter->second; // NOTE! This copy preserves immutability
+  notify_children(&msg_id, 1);
+}
+
+void broker::disassociate_everything(component* component) {
+  std::vector<message_id> msg_ids;
+
+  {
+    std::lock_guard<std::mutex> lock(associations_mutex_);
+
+    auto iter = associations_.find(component);
+    if (iter == std::end(associations_))
+      return;
+
+    msg_ids = std::move(iter->second);
+    associations_.erase(iter);
+  }
+
+  std::vector<shard*> touched_shards;
+
+  for (message_id msg_id : msg_ids) {
+    shard& target = shard_for(msg_id);
+    std::lock_guard<std::mutex> lock(target.write_mutex);
+    lookup_entry* entry = find_entry(target, msg_id);
+    if (!entry)
+      continue;
+
+    remove_receiver(*entry, component);
+    publish(target, msg_id, *entry);
+
+    if (std::find(std::begin(touched_shards), std::end(touched_shards), &target) == std::end(touched_shards))
+      touched_shards.push_back(&target);
+  }
+
+  // One grace period per shard for all of its replaced lists
+  for (shard* target : touched_shards) {
+    std::lock_guard<std::mutex> lock(target->write_mutex);
+    reclaim(*target);
+  }
+
+  notify_children(msg_ids.data(), msg_ids.size());
+}
+
+std::weak_ptr<message_receivers> broker::lookup(message_id msg_id) {
+  return lookup_as<std::weak_ptr<message_receivers>>(msg_id);
+}
+
+template<typename PointerType>
+PointerType broker::lookup_as(message_id msg_id) {
+  shard& target = shard_for(msg_id);
+
+  {
+    grace_period::reader_section section(target.readers);
+
+    if (const lookup_entry* entry = find_entry(target, msg_id))
+      return *entry->receivers.load();
+  }
+
+  // First lookup of this message id; the entry is created with an empty list, or the parent's
+  std::lock_guard<std::mutex> lock(target.write_mutex);
+  PointerType receivers = *entry_for(target, msg_id).receivers.load();
+  reclaim(target);
+  return receivers;
+}
+
+const std::atomic<std::uint64_t>& broker::generation(message_id msg_id) {
+  shard& target = shard_for(msg_id);
+
+  // Entries are never removed, so the counter can be used after leaving the section
+  {
+    grace_period::reader_section section(target.readers);
+
+    if (const lookup_entry* entry = find_entry(target, msg_id))
+      return entry->generation;
+  }
+
+  std::lock_guard<std::mutex> lock(target.write_mutex);
+  const std::atomic<std::uint64_t>& generation = entry_for(target, msg_id).generation;
+  reclaim(target);
+  return generation;
+}
+
+broker::lookup_entry* broker::find_entry(const shard& target, message_id msg_id) const {
+  const std::size_t slot = slot_of(msg_id);
+
+  if (slot < max_dense_slots)
+    return target.table.load()->find(slot);
+
+  const sparse_table* sparse = target.sparse.load();
+  return sparse ? sparse->find(msg_id) : nullptr;
+}
+
+broker::lookup_entry& broker::entry_for(shard& target, message_id msg_id) {
+  if (lookup_entry* entry = find_entry(target, msg_id))
+    return *entry;
+
+  auto& entry = target.entries.emplace_back(new lookup_entry);
+  publish(target, msg_id, *entry);
+
+  const std::size_t slot = slot_of(msg_id);
+
+  if (slot >= max_dense_slots) {
+    // Lookups might be reading the current table, so the new id goes into a copy
+    const sparse_table* sparse = target.sparse.load();
+    auto* new_sparse = new sparse_table;
+
+    if (sparse)
+      new_sparse->entries = sparse->entries;
+
+    auto position = std::lower_bound(std::begin(new_sparse->entries), std::end(new_sparse->entries), msg_id, [] (const auto& existing, message_id id) {
+      return existing.first < id;
+    });
+
+    new_sparse->entries.emplace(position, msg_id, entry.get());
+    target.sparse.store(new_sparse);
+
+    if (sparse)
+      target.retired_sparse_tables.push_back(sparse);
+
+    return *entry;
+  }
+
+  const lookup_table* table = target.table.load();
+
+  if (slot >= table->capacity) {
+    // Lookups might be reading the current table, so it's grown into a copy
+    auto* new_table = new lookup_table(std::max(slot + 1, table->capacity * 2));
+
+    for (std::size_t i = 0; i < table->capacity; ++i)
+      new_table->slots[i].store(table->slots[i].load(), std::memory_order_relaxed);
+
+    target.table.store(new_table);
+    target.retired_tables.push_back(table);
+    table = new_table;
+  }
+
+  table->slots[slot].store(entry.get());
+
+  return *entry;
+}
+
+void broker::remove_receiver(lookup_entry& entry, component* comp) {
+  message_receivers& receivers = entry.local;
 
   for (auto iter = std::begin(receivers); iter != std::end(receivers); ) {
     const std::weak_ptr<component>& receiver = *iter;
@@ -41,40 +267,76 @@ void broker::disassociate(message_id msg_id, component* comp) {
     else
       ++iter;
   }
-
-  iter->second = std::make_shared<message_receivers>(std::move(receivers));
 }
 
-void broker::invalidate(message_id msg_id) {
-  std::lock_guard<std::recursive_mutex> lock(lookup_mutex_);
+void broker::publish(shard& target, message_id msg_id, lookup_entry& entry) {
+  std::shared_ptr<message_receivers> resolved;
+
+  if (entry.local.empty() && parent_) {
+    std::shared_ptr<message_receivers> inherited = parent_->lookup_as<std::shared_ptr<message_receivers>>(msg_id);
+
+    // Copied rather than shared, so that our lookups expire when the parent replaces its list
+    resolved = std::make_shared<message_receivers>(*inherited);
+  }
+  else {
+    resolved = std::make_shared<message_receivers>(entry.local); // NOTE! This copy preserves immutability
+  }
 
-  auto iter = active_lookups_.find(msg_id);
-  if (iter == std::end(active_lookups_))
+  auto* new_receivers = new std::shared_ptr<message_receivers>(std::move(resolved));
+
+  if (const auto* old_receivers = entry.receivers.exchange(new_receivers))
+    target.retired_receivers.push_back(old_receivers);
+
+  entry.generation.fetch_add(1, std::memory_order_release);
+}
+
+void broker::reclaim(shard& target) {
+  if (target.retired_tables.empty() && target.retired_sparse_tables.empty() && target.retired_receivers.empty())
     return;
 
-  message_receivers receivers = *iter->second; // NOTE! This copy preserves immutability
-  iter->second = std::make_shared<message_receivers>(std::move(receivers));
+  target.readers.synchronize();
+
+  // Destroying the old lists expires the weak_ptrs that lookups handed out, which tells the caches to look up again
+  for (const auto* receivers : target.retired_receivers)
+    delete receivers;
+
+  for (const auto* table : target.retired_tables)
+    delete table;
+
+  for (const auto* sparse : target.retired_sparse_tables)
+    delete sparse;
+
+  target.retired_receivers.clear();
+  target.retired_tables.clear();
+  target.retired_sparse_tables.clear();
 }
 
-void broker::disassociate_everything(component* component) {
-  std::lock_guard<std::recursive_mutex> lock(lookup_mutex_);
+void broker::parent_changed(message_id msg_id) {
+  {
+    shard& target = shard_for(msg_id);
+    std::lock_guard<std::mutex> lock(target.write_mutex);
+    lookup_entry* entry = find_entry(target, msg_id);
+    if (!entry)
+      return;
+
+    // Our own receivers hide the parent's, so nothing has changed for our lookups
+    if (!entry->local.empty())
+      return;
 
-  for (auto& [msg_id, _] : active_lookups_) {
-    disassociate(msg_id, component);
+    publish(target, msg_id, *entry);
+    reclaim(target);
   }
+
+  notify_children(&msg_id, 1);
 }
 
-std::weak_ptr<message_receivers> broker::lookup(message_id msg_id) {
-  std::lock_guard<std::recursive_mutex> lock(lookup_mutex_);
+void broker::notify_children(const message_id* msg_ids, std::size_t count) {
+  std::lock_guard<std::mutex> lock(children_mutex_);
 
-  auto iter = active_lookups_.find(msg_id);
-  if (iter == std::end(active_lookups_)) {
-    std::shared_ptr<message_receivers> empty_receivers = std::make_shared<message_receivers>();
-    active_lookups_[msg_id] = empty_receivers;
-    return empty_receivers;
+  for (broker* child : children_) {
+    for (std::size_t i = 0; i < count; ++i)
+      child->parent_changed(msg_ids[i]);
   }
-
-  return iter->second;
 }
 
 }
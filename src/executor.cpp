@@ -1,5 +1,697 @@
 #include <minicomps/executor.h>
+#include <minicomps/executor_pool.h>
+
+#include <algorithm>
+#include <iterator>
 
 namespace mc {
 std::atomic_int executor::num_lock_failures_(0);
+
+namespace {
+
+std::atomic<std::uint64_t> next_executor_id(1);
+
+struct channel_cache_entry {
+  std::uint64_t executor_id;
+  std::shared_ptr<executor::channel> channel;
+};
+
+// Channels that this thread has used to send to other executors. Ids are never reused, so an entry can't
+// be confused with a new executor allocated at the same address.
+thread_local std::vector<channel_cache_entry> channel_cache;
+thread_local std::uint64_t last_channel_executor_id = 0;
+thread_local executor::channel* last_channel = nullptr;
+
+/// Lets the plain execute() run everything without looking at the clock
+struct unlimited_budget {
+  std::size_t executed = 0;
+
+  bool exhausted() const {
+    return false;
+  }
+};
+
+struct limited_budget {
+  limited_budget(std::size_t max_tasks, std::chrono::steady_clock::time_point deadline)
+    : max_tasks(max_tasks)
+    , deadline(deadline)
+    {}
+
+  std::size_t executed = 0;
+  const std::size_t max_tasks;
+  const std::chrono::steady_clock::time_point deadline;
+
+  bool exhausted() const {
+    if (executed >= max_tasks)
+      return true;
+
+    return deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline;
+  }
+};
+
+}
+
+executor::executor(queue_type type, std::size_t ring_capacity)
+  : type_(type)
+  , id_(next_executor_id++)
+  , ring_capacity_(ring_capacity) {
+  // Most work goes to the normal lane. The others are created when they're first used.
+  if (type_ == queue_type::LOCK_FREE_MPSC)
+    create_lock_free_lane(static_cast<std::size_t>(lane::NORMAL));
+}
+
+executor::~executor() {
+  for (auto& lane_items : lock_free_lanes_)
+    delete lane_items.load(std::memory_order_acquire);
+
+  // Threads might keep their channels around for a while, so we destroy the tasks right away
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto& inbound : channels_) {
+    for (auto& lane_items : inbound->lanes) {
+      if (spsc_queue<task>* items = lane_items.load(std::memory_order_acquire))
+        items->clear();
+    }
+
+    inbound->closed = true;
+  }
+}
+
+void executor::execute() {
+  unlimited_budget budget;
+  execute_within(budget, true);
+}
+
+std::size_t executor::execute(std::size_t max_tasks, std::chrono::steady_clock::time_point deadline) {
+  limited_budget budget(max_tasks, deadline);
+  execute_within(budget, true);
+  return budget.executed;
+}
+
+bool executor::try_execute(std::size_t max_tasks, std::chrono::steady_clock::time_point deadline) {
+  limited_budget budget(max_tasks, deadline);
+  return execute_within(budget, false);
+}
+
+template<typename BudgetType>
+bool executor::execute_within(BudgetType& budget, bool wait_for_lock) {
+  // Nested passes on other executors have their own staging, or none
+  executor* const outer_staging = staging_executor_;
+  executor* const outer_running = running_executor_;
+  staging_executor_ = staging_threshold_ != 0 ? this : nullptr;
+  running_executor_ = this;
+
+  // Only some of the passes that have work look at the clock
+  const std::uint64_t depth = queue_depth();
+  const bool idle = depth == 0 && (!timers_ || timers_->size() == 0) && (!io_ || io_->size() == 0);
+  const bool timed = !idle && num_busy_passes_++ % pass_sample_interval == 0;
+  const auto pass_start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+  if (depth > peak_queue_depth_.load(std::memory_order_relaxed))
+    peak_queue_depth_.store(depth, std::memory_order_relaxed);
+
+  // Timers and fd callbacks don't count as executed tasks, since they were never enqueued
+  const std::size_t timers_fired = run_expired_timers() + run_ready_io();
+  budget.executed += timers_fired;
+
+  const bool executed = execute_tasks(budget, wait_for_lock);
+
+  staging_executor_ = outer_staging;
+  running_executor_ = outer_running;
+  flush_staged();
+
+  // Drops and compaction free up space too
+  signal_space_available();
+
+  if (!idle)
+    num_passes_.store(num_busy_passes_, std::memory_order_relaxed);
+
+  if (timed)
+    pass_duration_.record(std::chrono::steady_clock::now() - pass_start);
+
+  return executed;
+}
+
+template<typename BudgetType>
+bool executor::execute_tasks(BudgetType& budget, bool wait_for_lock) {
+  std::size_t first_channel = 0;
+
+  switch (type_) {
+  case queue_type::LOCKING:
+    if (!take_locking_snapshot(wait_for_lock))
+      return false;
+    break;
+
+  case queue_type::LOCK_FREE_MPSC:
+    break;
+
+  case queue_type::SPSC_CHANNELS:
+    refresh_channels(wait_for_lock);
+
+    // Round-robin so that no producer gets to go first every time
+    if (!consumer_channels_.empty())
+      first_channel = next_channel_++ % consumer_channels_.size();
+    break;
+  }
+
+  if (found_canceled_) {
+    found_canceled_ = false;
+
+    if (queue_depth() >= compaction_threshold)
+      remove_canceled();
+  }
+
+  if (overflow_policy_ == overflow_policy::DROP_OLDEST && capacity_.load(std::memory_order_relaxed) != 0)
+    drop_oldest(first_channel);
+
+  // Lanes that haven't been able to run for a while go first, then the rest in priority order
+  std::size_t lane_order[num_lanes];
+  std::size_t num_ordered = 0;
+
+  for (std::size_t lane_index = 0; lane_index < num_lanes; ++lane_index) {
+    if (starved_passes_[lane_index] >= max_starved_passes)
+      lane_order[num_ordered++] = lane_index;
+  }
+
+  for (std::size_t lane_index = 0; lane_index < num_lanes; ++lane_index) {
+    if (starved_passes_[lane_index] < max_starved_passes)
+      lane_order[num_ordered++] = lane_index;
+  }
+
+  for (std::size_t lane_index : lane_order) {
+    if (budget.exhausted()) {
+      ++starved_passes_[lane_index];
+      continue;
+    }
+
+    starved_passes_[lane_index] = 0;
+    execute_lane(lane_index, budget, first_channel);
+  }
+
+  return true;
+}
+
+template<typename BudgetType>
+void executor::execute_lane(std::size_t lane_index, BudgetType& budget, std::size_t first_channel) {
+  std::uint64_t unpublished = 0;
+
+  // Producers that are bounded by the queue depth shouldn't have to wait for the whole pass to end
+  consume_lane(lane_index, first_channel,
+    [&] (task& item) {
+      item.execute();
+      ++budget.executed;
+
+      if (++unpublished == executed_publish_interval) {
+        publish_executed(unpublished);
+        unpublished = 0;
+      }
+    },
+    [&] {return budget.exhausted(); });
+
+  publish_executed(unpublished);
+}
+
+void executor::publish_executed(std::uint64_t count) {
+  if (count == 0)
+    return;
+
+  num_executed_.store(num_executed_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+  signal_space_available();
+}
+
+void executor::signal_space_available() {
+  if (capacity_.load(std::memory_order_relaxed) == 0)
+    return;
+
+  // Pairs with the increment in wait_for_space: either the producer sees the new count, or we see the producer
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (blocked_producers_.load(std::memory_order_relaxed) != 0)
+    space_available_.signal_all();
+}
+
+template<typename CallbackType, typename StopPredicateType>
+void executor::consume_lane(std::size_t lane_index, std::size_t first_channel, CallbackType&& callback, StopPredicateType&& should_stop) {
+  switch (type_) {
+  case queue_type::LOCKING: {
+    locking_lane& current = locking_lanes_[lane_index];
+
+    while (!current.back_buffer.empty() && !should_stop()) {
+      callback(current.back_buffer.front());
+      current.back_buffer.pop_front();
+    }
+
+    break;
+  }
+
+  case queue_type::LOCK_FREE_MPSC:
+    if (mpsc_queue<task>* items = lock_free_lanes_[lane_index].load(std::memory_order_acquire))
+      items->consume(callback, should_stop);
+    break;
+
+  case queue_type::SPSC_CHANNELS: {
+    const std::size_t num_channels = consumer_channels_.size();
+
+    for (std::size_t i = 0; i < num_channels && !should_stop(); ++i) {
+      channel& inbound = *consumer_channels_[(first_channel + i) % num_channels];
+
+      if (spsc_queue<task>* items = inbound.lanes[lane_index].load(std::memory_order_acquire))
+        items->consume(callback, should_stop);
+    }
+
+    break;
+  }
+  }
+}
+
+void executor::drop_oldest(std::size_t first_channel) {
+  const std::uint64_t capacity = capacity_.load(std::memory_order_relaxed);
+  const std::uint64_t depth = queue_depth();
+
+  if (depth <= capacity)
+    return;
+
+  // Responses and control tasks finish work that is already in flight, so they're kept
+  const std::uint64_t excess = depth - capacity;
+  std::uint64_t dropped = 0;
+
+  for (lane dropped_lane : {lane::BULK, lane::NORMAL}) {
+    consume_lane(static_cast<std::size_t>(dropped_lane), first_channel,
+      [&] (task& item) {task discarded(std::move(item)); ++dropped; },
+      [&] {return dropped >= excess; });
+  }
+
+  num_dropped_.store(num_dropped_.load(std::memory_order_relaxed) + dropped, std::memory_order_relaxed);
+}
+
+std::size_t executor::compact() {
+  switch (type_) {
+  case queue_type::LOCKING:
+    take_locking_snapshot(true);
+    break;
+
+  case queue_type::LOCK_FREE_MPSC:
+    break;
+
+  case queue_type::SPSC_CHANNELS:
+    refresh_channels(true);
+    break;
+  }
+
+  return remove_canceled();
+}
+
+std::size_t executor::remove_canceled() {
+  auto canceled = [] (const task& item) {return item.canceled(); };
+  std::size_t removed = 0;
+
+  for (std::size_t lane_index = 0; lane_index < num_lanes; ++lane_index) {
+    switch (type_) {
+    case queue_type::LOCKING:
+      removed += locking_lanes_[lane_index].back_buffer.remove_if(canceled);
+      break;
+
+    case queue_type::LOCK_FREE_MPSC:
+      if (mpsc_queue<task>* items = lock_free_lanes_[lane_index].load(std::memory_order_acquire))
+        removed += items->remove_if(canceled);
+      break;
+
+    case queue_type::SPSC_CHANNELS:
+      for (const std::shared_ptr<channel>& inbound : consumer_channels_) {
+        if (spsc_queue<task>* items = inbound->lanes[lane_index].load(std::memory_order_acquire))
+          removed += items->remove_if(canceled);
+      }
+      break;
+    }
+  }
+
+  num_compacted_.store(num_compacted_.load(std::memory_order_relaxed) + removed, std::memory_order_relaxed);
+  canceled_requests_.store(canceled_requests_.load(std::memory_order_relaxed) + removed, std::memory_order_relaxed);
+  return removed;
+}
+
+bool executor::admit_bounded(work_kind kind, std::size_t count, std::size_t capacity) {
+  if (queue_depth() < capacity)
+    return true;
+
+  switch (overflow_policy_) {
+  case overflow_policy::BLOCK:
+    // The consumer would be waiting for itself
+    if (running_executor_ != this)
+      wait_for_space(capacity);
+
+    return true;
+
+  case overflow_policy::FAIL_QUERIES:
+    if (kind != work_kind::REQUEST)
+      return true;
+
+    rejected_queries_.fetch_add(count, std::memory_order_relaxed);
+    return false;
+
+  case overflow_policy::DROP_OLDEST:
+    return true;
+
+  case overflow_policy::DROP_EVENTS:
+    if (kind != work_kind::EVENT)
+      return true;
+
+    dropped_events_.fetch_add(count, std::memory_order_relaxed);
+    return false;
+  }
+
+  return true;
+}
+
+void executor::wait_for_space(std::size_t capacity) {
+  blocked_enqueues_.fetch_add(1, std::memory_order_relaxed);
+  blocked_producers_.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst); // Pairs with the fence in signal_space_available
+
+  for (;;) {
+    const std::uint32_t epoch = space_available_.prepare();
+
+    if (queue_depth() < capacity)
+      break;
+
+    // The timeout is a backstop in case the limit is changed while we're waiting
+    space_available_.wait(epoch, std::chrono::milliseconds(10));
+  }
+
+  blocked_producers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool executor::take_locking_snapshot(bool wait_for_lock) {
+  if (!lock_queue(wait_for_lock))
+    return false;
+
+  for (locking_lane& current : locking_lanes_) {
+    // Tasks left over from an earlier call stay in front. Chunks that we're done with go back to the producers.
+    current.back_buffer.splice(current.items);
+    current.items.take_spare_chunks(current.back_buffer);
+  }
+
+  mutex_.unlock();
+  return true;
+}
+
+void executor::refresh_channels(bool wait_for_lock) {
+  if (!channels_changed_.exchange(false, std::memory_order_acquire))
+    return;
+
+  if (lock_queue(wait_for_lock)) {
+    consumer_channels_ = channels_;
+    mutex_.unlock();
+  }
+  else {
+    // New producers will be picked up next time; the ones we know about can still be drained
+    channels_changed_.store(true, std::memory_order_relaxed);
+  }
+}
+
+mpsc_queue<task>& executor::create_lock_free_lane(std::size_t lane_index) {
+  auto* created = new mpsc_queue<task>(ring_capacity_);
+  mpsc_queue<task>* existing = nullptr;
+
+  if (lock_free_lanes_[lane_index].compare_exchange_strong(existing, created, std::memory_order_acq_rel))
+    return *created;
+
+  // Another producer got there first
+  delete created;
+  return *existing;
+}
+
+executor_stats executor::stats() const {
+  executor_stats result;
+
+  // Tasks are counted as enqueued before they're visible to the consumer, so reading the executed count first
+  // keeps the depth from going negative
+  result.executed_tasks = num_executed_.load(std::memory_order_relaxed);
+  result.dropped_tasks = num_dropped_.load(std::memory_order_relaxed);
+  result.compacted_tasks = num_compacted_.load(std::memory_order_relaxed);
+  result.enqueued_tasks = num_enqueued_.load(std::memory_order_relaxed);
+
+  const std::uint64_t retired = result.executed_tasks + result.dropped_tasks + result.compacted_tasks;
+  result.queue_depth = result.enqueued_tasks > retired ? result.enqueued_tasks - retired : 0;
+  result.peak_queue_depth = peak_queue_depth_.load(std::memory_order_relaxed);
+  result.lock_failures = lock_failures_.load(std::memory_order_relaxed);
+  result.execute_passes = num_passes_.load(std::memory_order_relaxed);
+  result.blocked_enqueues = blocked_enqueues_.load(std::memory_order_relaxed);
+  result.rejected_queries = rejected_queries_.load(std::memory_order_relaxed);
+  result.dropped_events = dropped_events_.load(std::memory_order_relaxed);
+  result.expired_requests = expired_requests_.load(std::memory_order_relaxed);
+  result.canceled_requests = canceled_requests_.load(std::memory_order_relaxed);
+  result.enqueue_to_execute = enqueue_to_execute_.snapshot();
+  result.pass_duration = pass_duration_.snapshot();
+  return result;
+}
+
+executor::staged_batch& executor::staged_batch_for(executor& target) {
+  if (last_staged_batch_ < staged_batches_.size() && staged_batches_[last_staged_batch_]->target == &target)
+    return *staged_batches_[last_staged_batch_];
+
+  auto iter = std::find_if(std::begin(staged_batches_), std::end(staged_batches_), [&] (const std::unique_ptr<staged_batch>& batch) {
+    return batch->target == &target;
+  });
+
+  if (iter == std::end(staged_batches_)) {
+    // Batches are kept for reuse once they've been flushed, so an empty batch can be taken over by a new target
+    iter = std::find_if(std::begin(staged_batches_), std::end(staged_batches_), [] (const std::unique_ptr<staged_batch>& batch) {
+      return batch->size == 0;
+    });
+
+    if (iter == std::end(staged_batches_))
+      iter = staged_batches_.insert(std::end(staged_batches_), std::make_unique<staged_batch>());
+
+    (*iter)->target = &target;
+  }
+
+  last_staged_batch_ = static_cast<std::size_t>(iter - std::begin(staged_batches_));
+  return **iter;
+}
+
+void executor::flush_staged() {
+  if (num_staged_ == 0)
+    return;
+
+  for (auto& batch : staged_batches_) {
+    if (batch->size != 0)
+      flush_staged(*batch);
+  }
+}
+
+void executor::flush_staged(staged_batch& batch) {
+  num_staged_ -= batch.size;
+  batch.size = 0;
+  batch.target->enqueue_staged(batch);
+}
+
+void executor::enqueue_staged(staged_batch& batch) {
+  // Staged tasks are handed over by the thread that staged them, so they keep their order
+  auto move_staged = [] (task_ring<task>& staged) {
+    return [&staged] (std::size_t, auto&& emplace) {
+      emplace(std::move(staged.front()));
+      staged.pop_front();
+    };
+  };
+
+  std::size_t num_staged = 0;
+
+  for (const task_ring<task>& staged : batch.lanes)
+    num_staged += staged.size();
+
+  num_enqueued_.fetch_add(num_staged, std::memory_order_relaxed);
+  bool wake_consumer = false;
+
+  switch (type_) {
+  case queue_type::LOCKING:
+    if (!mutex_.try_lock()) {
+      count_lock_failure();
+      mutex_.lock();
+    }
+
+    for (std::size_t lane_index = 0; lane_index < num_lanes; ++lane_index) {
+      task_ring<task>& staged = batch.lanes[lane_index];
+
+      while (!staged.empty()) {
+        locking_lanes_[lane_index].items.emplace_back(std::move(staged.front()));
+        staged.pop_front();
+      }
+    }
+
+    wake_consumer = claim_waiting_consumer();
+    mutex_.unlock();
+    break;
+
+  case queue_type::LOCK_FREE_MPSC:
+    for (std::size_t lane_index = 0; lane_index < num_lanes; ++lane_index) {
+      task_ring<task>& staged = batch.lanes[lane_index];
+
+      if (!staged.empty())
+        lock_free_lane(lane_index).emplace_batch(staged.size(), move_staged(staged));
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake_consumer = claim_waiting_consumer();
+    break;
+
+  case queue_type::SPSC_CHANNELS:
+    for (std::size_t lane_index = 0; lane_index < num_lanes; ++lane_index) {
+      task_ring<task>& staged = batch.lanes[lane_index];
+
+      if (!staged.empty())
+        producer_channel().producer_lane(lane_index).emplace_batch(staged.size(), move_staged(staged));
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake_consumer = claim_waiting_consumer();
+    break;
+  }
+
+  if (wake_consumer)
+    signal_consumer();
+
+  notify_pool();
+}
+
+bool executor::wait_for_work(std::chrono::steady_clock::duration timeout) {
+  const auto now = std::chrono::steady_clock::now();
+
+  // Saturated, since huge timeouts like duration::max() mean "wait forever" and would overflow
+  const auto deadline = timeout >= std::chrono::steady_clock::time_point::max() - now ? std::chrono::steady_clock::time_point::max() : now + timeout;
+
+  for (;;) {
+    // Taken before we check for work, so a wakeup that comes after the check isn't lost
+    const std::uint32_t epoch = wakeup_.prepare();
+
+    // Pairs with the fence in enqueue_work: either the producer sees that we're waiting, or we see its
+    // task. The locking queue gets the same guarantee from its mutex.
+    consumer_waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (has_pending_work()) {
+      consumer_waiting_.store(false, std::memory_order_relaxed);
+      return true;
+    }
+
+    // Timers are due even if nobody enqueues anything
+    const auto wake_up_at = std::min(deadline, timers_ ? timers_->next_deadline() : deadline);
+
+    // Once producers have switched to the poller's eventfd, we have to keep waiting there
+    if (io_wakeup_.load(std::memory_order_relaxed))
+      io_->wait(wake_up_at - std::chrono::steady_clock::now());
+    else
+      wakeup_.wait(epoch, wake_up_at - std::chrono::steady_clock::now());
+
+    consumer_waiting_.store(false, std::memory_order_relaxed);
+
+    if (has_pending_work())
+      return true;
+
+    if (std::chrono::steady_clock::now() >= deadline)
+      return false;
+  }
+}
+
+bool executor::has_pending_work() {
+  if (timers_ && timers_->next_deadline() <= std::chrono::steady_clock::now())
+    return true;
+
+  if (io_ && io_->has_ready())
+    return true;
+
+  switch (type_) {
+  case queue_type::LOCKING: {
+    for (const locking_lane& current : locking_lanes_) {
+      if (!current.back_buffer.empty())
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return std::any_of(std::begin(locking_lanes_), std::end(locking_lanes_), [] (const locking_lane& current) {
+      return !current.items.empty();
+    });
+  }
+
+  case queue_type::LOCK_FREE_MPSC:
+    return std::any_of(std::begin(lock_free_lanes_), std::end(lock_free_lanes_), [] (const std::atomic<mpsc_queue<task>*>& lane_items) {
+      mpsc_queue<task>* items = lane_items.load(std::memory_order_acquire);
+      return items && !items->empty();
+    });
+
+  case queue_type::SPSC_CHANNELS:
+    if (channels_changed_.load(std::memory_order_acquire))
+      return true;
+
+    return std::any_of(std::begin(consumer_channels_), std::end(consumer_channels_), [] (const std::shared_ptr<channel>& inbound) {
+      return std::any_of(std::begin(inbound->lanes), std::end(inbound->lanes), [] (const std::atomic<spsc_queue<task>*>& lane_items) {
+        spsc_queue<task>* items = lane_items.load(std::memory_order_acquire);
+        return items && !items->empty();
+      });
+    });
+  }
+
+  return false;
+}
+
+bool executor::watch_fd(int fd, std::uint32_t events, const lifetime& life, std::function<void(std::uint32_t)> callback) {
+  if (!io_)
+    io_ = std::make_unique<io_poller>();
+
+  if (!io_->watch(fd, events, life, std::move(callback)))
+    return false;
+
+  // From now on producers wake us through the poller's eventfd
+  io_wakeup_.store(io_.get(), std::memory_order_release);
+  return true;
+}
+
+bool executor::lock_queue(bool wait_for_lock) {
+  if (mutex_.try_lock())
+    return true;
+
+  count_lock_failure();
+
+  if (!wait_for_lock)
+    return false;
+
+  mutex_.lock();
+  return true;
+}
+
+void executor::schedule_on_pool() {
+  pool_->schedule(this);
+}
+
+executor::channel& executor::producer_channel() {
+  if (last_channel_executor_id == id_)
+    return *last_channel;
+
+  auto iter = std::find_if(std::begin(channel_cache), std::end(channel_cache), [this] (const channel_cache_entry& entry) {
+    return entry.executor_id == id_;
+  });
+
+  if (iter == std::end(channel_cache)) {
+    // Forget about channels to executors that have been destroyed
+    channel_cache.erase(std::remove_if(std::begin(channel_cache), std::end(channel_cache), [] (const channel_cache_entry& entry) {
+      return entry.channel->closed.load(std::memory_order_relaxed);
+    }), std::end(channel_cache));
+
+    auto new_channel = std::make_shared<channel>();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      channels_.push_back(new_channel);
+      channels_changed_.store(true, std::memory_order_release);
+    }
+
+    iter = channel_cache.insert(std::end(channel_cache), {id_, std::move(new_channel)});
+  }
+
+  last_channel_executor_id = id_;
+  last_channel = iter->channel.get();
+  return *last_channel;
+}
+
 }
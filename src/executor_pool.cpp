@@ -0,0 +1,200 @@
+/// Copyright 2022 Peter Backman
+
+#include <minicomps/executor_pool.h>
+
+#include <algorithm>
+
+namespace mc {
+
+namespace {
+
+// Lets a worker schedule executors on its own queue
+thread_local executor_pool* current_pool = nullptr;
+thread_local std::size_t current_worker_index = 0;
+
+}
+
+executor_pool::executor_pool(std::size_t num_workers) {
+  num_workers = std::max<std::size_t>(num_workers, 1);
+
+  for (std::size_t i = 0; i < num_workers; ++i)
+    workers_.push_back(std::make_unique<worker>());
+
+  for (std::size_t i = 0; i < num_workers; ++i)
+    workers_[i]->thread = std::thread([this, i] {run_worker(i); });
+}
+
+executor_pool::~executor_pool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+
+  wakeup_.notify_all();
+
+  for (auto& w : workers_)
+    w->thread.join();
+
+  std::lock_guard<std::mutex> lock(attach_mutex_);
+
+  // No worker is running anymore, so we can just tell the executors that they're detached
+  for (auto& exec : attached_) {
+    exec->pool_attached_ = false;
+    exec->strand_state_ = executor::strand_state::DETACHED;
+    exec->pool_ = nullptr;
+  }
+}
+
+void executor_pool::attach(const executor_ptr& exec) {
+  std::lock_guard<std::mutex> lock(attach_mutex_);
+
+  if (exec->pool_attached_)
+    std::abort(); // Already attached to a pool. TODO: make this behavior configurable
+
+  attached_.push_back(exec);
+
+  // Make sure that every ready queue can hold all attached executors
+  for (auto& w : workers_) {
+    std::lock_guard<std::mutex> worker_lock(w->mutex);
+
+    if (w->ready.size() >= attached_.size())
+      continue;
+
+    std::vector<executor*> ready(std::max<std::size_t>(w->ready.size() * 2, 8));
+
+    for (std::size_t i = 0; i < w->count; ++i)
+      ready[i] = w->ready[(w->head + i) % w->ready.size()];
+
+    w->ready = std::move(ready);
+    w->head = 0;
+  }
+
+  exec->pool_ = this;
+  exec->pool_attached_ = true;
+  exec->strand_state_ = executor::strand_state::SCHEDULED;
+
+  // Work might have been enqueued before we attached. Executing once too many is harmless.
+  schedule(exec.get());
+}
+
+void executor_pool::detach(const executor_ptr& exec) {
+  exec->pool_attached_ = false;
+
+  // Wait until no worker has the executor queued or running. Once it's DETACHED, producers won't schedule it.
+  for (;;) {
+    auto state = executor::strand_state::IDLE;
+    if (exec->strand_state_.compare_exchange_weak(state, executor::strand_state::DETACHED, std::memory_order_acq_rel))
+      break;
+
+    std::this_thread::yield();
+  }
+
+  std::lock_guard<std::mutex> lock(attach_mutex_);
+  exec->pool_ = nullptr;
+  attached_.erase(std::remove(std::begin(attached_), std::end(attached_), exec), std::end(attached_));
+}
+
+void executor_pool::schedule(executor* exec) {
+  std::size_t worker_index;
+
+  if (current_pool == this)
+    worker_index = current_worker_index;
+  else
+    worker_index = next_worker_++ % workers_.size();
+
+  // Counted before it's pushed, so a worker that takes it right away can't bring the count below zero
+  num_ready_.fetch_add(1, std::memory_order_seq_cst);
+  push(*workers_[worker_index], exec);
+
+  if (num_sleeping_.load(std::memory_order_seq_cst) > 0) {
+    // Taking the lock makes sure that a worker that's about to sleep either sees `num_ready_` or gets notified
+    { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+    wakeup_.notify_one();
+  }
+}
+
+void executor_pool::push(worker& target, executor* exec) {
+  std::lock_guard<std::mutex> lock(target.mutex);
+  target.ready[(target.head + target.count) % target.ready.size()] = exec;
+  ++target.count;
+}
+
+executor* executor_pool::pop_front(worker& source) {
+  std::lock_guard<std::mutex> lock(source.mutex);
+
+  if (source.count == 0)
+    return nullptr;
+
+  executor* exec = source.ready[source.head];
+  source.head = (source.head + 1) % source.ready.size();
+  --source.count;
+  return exec;
+}
+
+executor* executor_pool::pop_back(worker& source) {
+  std::lock_guard<std::mutex> lock(source.mutex);
+
+  if (source.count == 0)
+    return nullptr;
+
+  --source.count;
+  return source.ready[(source.head + source.count) % source.ready.size()];
+}
+
+executor* executor_pool::find_work(std::size_t worker_index) {
+  executor* exec = pop_front(*workers_[worker_index]);
+
+  // Steal from the back of the other workers' queues
+  for (std::size_t i = 1; !exec && i < workers_.size(); ++i)
+    exec = pop_back(*workers_[(worker_index + i) % workers_.size()]);
+
+  if (exec)
+    num_ready_.fetch_sub(1, std::memory_order_relaxed);
+
+  return exec;
+}
+
+void executor_pool::wait_for_work() {
+  std::unique_lock<std::mutex> lock(sleep_mutex_);
+  num_sleeping_.fetch_add(1, std::memory_order_seq_cst);
+
+  wakeup_.wait(lock, [this] {
+    return stopping_ || num_ready_.load(std::memory_order_seq_cst) > 0;
+  });
+
+  num_sleeping_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void executor_pool::run_worker(std::size_t worker_index) {
+  current_pool = this;
+  current_worker_index = worker_index;
+
+  while (!stopping_) {
+    executor* exec = find_work(worker_index);
+
+    if (!exec) {
+      // Doesn't sleep while `num_ready_` is above zero, so if another worker has counted an executor it hasn't
+      // pushed yet, we look again until it's there
+      wait_for_work();
+      continue;
+    }
+
+    exec->strand_state_.store(executor::strand_state::RUNNING, std::memory_order_relaxed);
+
+    // Pairs with the fence in executor::notify_pool: either we see the producer's task, or the producer sees
+    // that we're running and tells us to run again
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    exec->execute();
+
+    auto state = executor::strand_state::RUNNING;
+    if (!exec->strand_state_.compare_exchange_strong(state, executor::strand_state::IDLE, std::memory_order_acq_rel)) {
+      // More work arrived while we were running. Put the executor at the back of the queue so that others get a turn.
+      exec->strand_state_.store(executor::strand_state::SCHEDULED, std::memory_order_relaxed);
+      schedule(exec);
+    }
+  }
+
+  current_pool = nullptr;
+}
+
+}
@@ -0,0 +1,171 @@
+/// Copyright 2022 Peter Backman
+
+#include <minicomps/io_poller.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace mc {
+
+#if defined(__linux__)
+
+namespace {
+
+constexpr std::uint64_t wakeup_data = UINT64_MAX;
+
+}
+
+io_poller::io_poller()
+  : epoll_fd_(epoll_create1(EPOLL_CLOEXEC))
+  , event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+  if (epoll_fd_ < 0 || event_fd_ < 0)
+    std::abort();
+
+  epoll_event wakeup_event{};
+  wakeup_event.events = EPOLLIN;
+  wakeup_event.data.u64 = wakeup_data;
+
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &wakeup_event) != 0)
+    std::abort();
+}
+
+io_poller::~io_poller() {
+  close(event_fd_);
+  close(epoll_fd_);
+}
+
+bool io_poller::watch(int fd, std::uint32_t events, const lifetime& life, std::function<void(std::uint32_t)> callback) {
+  if (fd < 0)
+    return false;
+
+  const std::uint32_t serial = next_serial_++;
+
+  epoll_event watched{};
+  watched.events = events;
+  watched.data.u64 = (std::uint64_t{serial} << 32) | static_cast<std::uint32_t>(fd);
+
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &watched) != 0) {
+    // Either we're replacing a watch, or the fd was closed and reused without being unwatched
+    if (errno != EEXIST || epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &watched) != 0)
+      return false;
+  }
+
+  if (static_cast<std::size_t>(fd) >= watches_.size())
+    watches_.resize(fd + 1);
+
+  if (!watches_[fd])
+    ++num_watches_;
+
+  watches_[fd] = std::make_shared<watch_entry>(watch_entry{serial, life.create_weak_ptr(), std::move(callback)});
+  return true;
+}
+
+bool io_poller::unwatch(int fd) {
+  if (fd < 0 || static_cast<std::size_t>(fd) >= watches_.size() || !watches_[fd])
+    return false;
+
+  // Fails if the fd has been closed, which has removed it from the set already
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  watches_[fd].reset();
+  --num_watches_;
+  return true;
+}
+
+void io_poller::wait(std::chrono::steady_clock::duration timeout) {
+  if (has_ready())
+    return;
+
+  // Rounded up, so we don't wake up just before a deadline and spin
+  const auto timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+  poll(timeout_ms > 0 ? static_cast<int>(std::min<std::int64_t>(timeout_ms, INT32_MAX)) : 0);
+}
+
+std::size_t io_poller::run_ready() {
+  if (!has_ready()) {
+    if (num_watches_ == 0)
+      return 0;
+
+    poll(0);
+  }
+
+  std::size_t num_run = 0;
+
+  while (has_ready()) {
+    const ready_event ready = ready_[next_ready_++];
+    const int fd = static_cast<int>(ready.data & UINT32_MAX);
+
+    if (static_cast<std::size_t>(fd) >= watches_.size() || !watches_[fd])
+      continue;
+
+    std::shared_ptr<watch_entry> entry = watches_[fd];
+
+    if (entry->serial != ready.data >> 32)
+      continue;
+
+    if (entry->lifetime.expired()) {
+      unwatch(fd);
+      continue;
+    }
+
+    entry->callback(ready.events);
+    ++num_run;
+  }
+
+  return num_run;
+}
+
+void io_poller::wake() {
+  const std::uint64_t one = 1;
+  [[maybe_unused]] const ssize_t written = write(event_fd_, &one, sizeof(one));
+}
+
+void io_poller::poll(int timeout_ms) {
+  epoll_event events[max_events];
+  const int num_events = epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+
+  num_ready_ = next_ready_ = 0;
+
+  for (int i = 0; i < num_events; ++i) {
+    if (events[i].data.u64 == wakeup_data) {
+      std::uint64_t count;
+      [[maybe_unused]] const ssize_t read_bytes = read(event_fd_, &count, sizeof(count));
+      continue;
+    }
+
+    ready_[num_ready_++] = {events[i].data.u64, events[i].events};
+  }
+}
+
+#else
+
+io_poller::io_poller() = default;
+io_poller::~io_poller() = default;
+
+bool io_poller::watch(int, std::uint32_t, const lifetime&, std::function<void(std::uint32_t)>) {
+  return false;
+}
+
+bool io_poller::unwatch(int) {
+  return false;
+}
+
+void io_poller::wait(std::chrono::steady_clock::duration) {}
+
+std::size_t io_poller::run_ready() {
+  return 0;
+}
+
+void io_poller::wake() {}
+
+void io_poller::poll(int) {}
+
+#endif
+
+}
@@ -0,0 +1,17 @@
+/// Copyright 2022 Peter Backman
+
+#include <minicomps/messaging.h>
+
+namespace mc {
+
+namespace {
+
+std::atomic<message_id> next_message_id{1};
+
+}
+
+message_id allocate_message_id() {
+  return next_message_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,70 @@
+/// Copyright 2022 Peter Backman
+
+#include <minicomps/task_pool.h>
+
+#include <new>
+
+namespace mc {
+
+task_pool::~task_pool() {
+  for (size_class& blocks : size_classes_) {
+    free_block* current = blocks.free_blocks.load(std::memory_order_acquire);
+
+    while (current) {
+      free_block* next = current->next;
+      ::operator delete(current);
+      current = next;
+    }
+  }
+}
+
+void* task_pool::allocate(std::size_t size) {
+  num_allocations_.fetch_add(1, std::memory_order_relaxed);
+  const std::size_t index = size_class_index(size);
+
+  if (index == num_size_classes)
+    return ::operator new(size);
+
+  size_class& blocks = size_classes_[index];
+
+  if (!blocks.free_blocks.load(std::memory_order_relaxed))
+    return ::operator new(min_block_size << index);
+
+  // Only one thread at a time pops, so the block we're looking at can't be popped and pushed back in between
+  // reading its `next` and swapping it out. Blocks pushed in the meantime just make the swap fail.
+  std::lock_guard<std::mutex> lock(blocks.allocate_mutex);
+  free_block* block = blocks.free_blocks.load(std::memory_order_acquire);
+
+  while (block && !blocks.free_blocks.compare_exchange_weak(block, block->next, std::memory_order_acquire, std::memory_order_acquire)) {}
+
+  if (!block)
+    return ::operator new(min_block_size << index);
+
+  return block;
+}
+
+void task_pool::deallocate(void* block, std::size_t size) {
+  const std::size_t index = size_class_index(size);
+
+  if (index == num_size_classes) {
+    ::operator delete(block);
+    return;
+  }
+
+  size_class& blocks = size_classes_[index];
+  free_block* released = static_cast<free_block*>(block);
+  released->next = blocks.free_blocks.load(std::memory_order_relaxed);
+
+  while (!blocks.free_blocks.compare_exchange_weak(released->next, released, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+std::size_t task_pool::size_class_index(std::size_t size) {
+  std::size_t index = 0;
+
+  while (index < num_size_classes && (min_block_size << index) < size)
+    ++index;
+
+  return index;
+}
+
+}
@@ -0,0 +1,237 @@
+/// Copyright 2022 Peter Backman
+
+#include <minicomps/timer_wheel.h>
+
+#include <algorithm>
+
+namespace mc {
+
+namespace {
+
+int count_trailing_zeros(std::uint64_t value) {
+  return __builtin_ctzll(value);
+}
+
+}
+
+timer_wheel::timer_wheel(clock::duration resolution, clock::time_point start)
+  : resolution_(resolution)
+  , start_(start) {
+  std::fill(std::begin(heads_), std::end(heads_), nil);
+  std::fill(std::begin(tails_), std::end(tails_), nil);
+}
+
+bool timer_wheel::cancel(timer_handle handle) {
+  if (handle.index >= chunks_.size() * nodes_per_chunk)
+    return false;
+
+  node& timer = get_node(handle.index);
+  if (timer.generation != handle.generation)
+    return false;
+
+  switch (timer.state) {
+  case node_state::SCHEDULED:
+    unlink(handle.index);
+    free_node(handle.index);
+    return true;
+
+  case node_state::RUNNING:
+    // The callback is canceling itself (or a callback is canceling a periodic timer); it's freed after the callback returns
+    timer.state = node_state::CANCELED_WHILE_RUNNING;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+std::size_t timer_wheel::advance(clock::time_point now) {
+  const std::uint64_t now_tick = now > start_ ? static_cast<std::uint64_t>((now - start_) / resolution_) : 0;
+  std::size_t fired = 0;
+
+  while (current_tick_ < now_tick) {
+    const std::uint64_t next_tick = num_timers_ > 0 ? next_interesting_tick() : now_tick + 1;
+
+    if (next_tick > now_tick) {
+      // Nothing happens in between, so we can skip ahead
+      current_tick_ = now_tick;
+      break;
+    }
+
+    current_tick_ = next_tick;
+
+    if ((current_tick_ & slot_mask) == 0)
+      cascade();
+
+    fired += fire_slot(static_cast<std::uint16_t>(current_tick_ & slot_mask));
+  }
+
+  return fired;
+}
+
+timer_wheel::clock::time_point timer_wheel::next_deadline() const {
+  if (num_timers_ == 0)
+    return clock::time_point::max();
+
+  return start_ + resolution_ * static_cast<clock::rep>(next_interesting_tick());
+}
+
+/// The next tick with timers on the lowest level, or the next time the lowest level wraps around and the
+/// higher levels have to be cascaded
+std::uint64_t timer_wheel::next_interesting_tick() const {
+  const std::uint64_t next_tick = current_tick_ + 1;
+  const std::uint64_t next_slot = next_tick & slot_mask;
+
+  if (next_slot == 0)
+    return next_tick;
+
+  if (const std::uint64_t pending = occupied_[0] >> next_slot)
+    return next_tick + count_trailing_zeros(pending);
+
+  return (next_tick | slot_mask) + 1;
+}
+
+std::uint32_t timer_wheel::allocate_node() {
+  if (free_nodes_ == nil) {
+    const std::uint32_t first_index = static_cast<std::uint32_t>(chunks_.size() * nodes_per_chunk);
+    chunks_.push_back(std::make_unique<node[]>(nodes_per_chunk));
+
+    for (std::uint32_t i = nodes_per_chunk; i-- > 0;) {
+      chunks_.back()[i].next = free_nodes_;
+      free_nodes_ = first_index + i;
+    }
+  }
+
+  const std::uint32_t index = free_nodes_;
+  free_nodes_ = get_node(index).next;
+  ++num_timers_;
+  return index;
+}
+
+void timer_wheel::free_node(std::uint32_t index) {
+  node& timer = get_node(index);
+  ++timer.generation;
+  timer.state = node_state::FREE;
+  timer.callback.reset();
+  timer.lifetime.reset();
+  timer.invoke = nullptr;
+  timer.prev = nil;
+  timer.next = free_nodes_;
+  free_nodes_ = index;
+  --num_timers_;
+}
+
+void timer_wheel::insert(std::uint32_t index) {
+  node& timer = get_node(index);
+
+  // Cascaded timers can expire on the current tick; they're put in the slot that is about to fire
+  std::uint64_t expires = std::max(timer.expires, current_tick_);
+  std::uint64_t delta = expires - current_tick_;
+
+  // Timers beyond the wheel's range are parked in the last slot they can reach and re-inserted when it cascades
+  const std::uint64_t max_delta = (std::uint64_t{1} << (slot_bits * num_levels)) - 1;
+
+  if (delta > max_delta) {
+    expires = current_tick_ + max_delta;
+    delta = max_delta;
+  }
+
+  std::size_t level = 0;
+
+  while (level + 1 < num_levels && delta >= (std::uint64_t{1} << (slot_bits * (level + 1))))
+    ++level;
+
+  const std::uint64_t slot = (expires >> (slot_bits * level)) & slot_mask;
+  link(index, static_cast<std::uint16_t>(level * num_slots + slot));
+}
+
+void timer_wheel::link(std::uint32_t index, std::uint16_t list) {
+  node& timer = get_node(index);
+  timer.list = list;
+  timer.next = nil;
+  timer.prev = tails_[list];
+
+  if (tails_[list] == nil)
+    heads_[list] = index;
+  else
+    get_node(tails_[list]).next = index;
+
+  tails_[list] = index;
+  occupied_[list / num_slots] |= std::uint64_t{1} << (list % num_slots);
+}
+
+void timer_wheel::unlink(std::uint32_t index) {
+  node& timer = get_node(index);
+  const std::uint16_t list = timer.list;
+
+  if (timer.prev == nil)
+    heads_[list] = timer.next;
+  else
+    get_node(timer.prev).next = timer.next;
+
+  if (timer.next == nil)
+    tails_[list] = timer.prev;
+  else
+    get_node(timer.next).prev = timer.prev;
+
+  timer.prev = nil;
+  timer.next = nil;
+
+  if (heads_[list] == nil)
+    occupied_[list / num_slots] &= ~(std::uint64_t{1} << (list % num_slots));
+}
+
+/// Moves the timers in the higher-level slots that the current tick has reached down to lower levels
+void timer_wheel::cascade() {
+  for (std::size_t level = num_levels - 1; level >= 1; --level) {
+    const std::uint64_t level_mask = (std::uint64_t{1} << (slot_bits * level)) - 1;
+    if ((current_tick_ & level_mask) != 0)
+      continue;
+
+    const std::uint16_t list = static_cast<std::uint16_t>(level * num_slots + ((current_tick_ >> (slot_bits * level)) & slot_mask));
+
+    while (heads_[list] != nil) {
+      const std::uint32_t index = heads_[list];
+      unlink(index);
+
+      if (get_node(index).lifetime.expired())
+        free_node(index);
+      else
+        insert(index);
+    }
+  }
+}
+
+std::size_t timer_wheel::fire_slot(std::uint16_t list) {
+  std::size_t fired = 0;
+
+  // Callbacks can schedule and cancel timers, but new timers never end up in the slot that is firing
+  while (heads_[list] != nil) {
+    const std::uint32_t index = heads_[list];
+    unlink(index);
+
+    node& timer = get_node(index);
+
+    if (timer.lifetime.expired()) {
+      free_node(index);
+      continue;
+    }
+
+    timer.state = node_state::RUNNING;
+    timer.invoke(timer.callback.get_object_ptr());
+    ++fired;
+
+    if (timer.state == node_state::RUNNING && timer.period != 0 && !timer.lifetime.expired()) {
+      timer.state = node_state::SCHEDULED;
+      timer.expires = current_tick_ + timer.period;
+      insert(index);
+    }
+    else {
+      free_node(index);
+    }
+  }
+
+  return fired;
+}
+
+}
@@ -0,0 +1,68 @@
+/// Copyright 2022 Peter Backman
+
+#include <minicomps/wakeup_event.h>
+
+#include <limits>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace mc {
+
+#if defined(__linux__)
+
+void wakeup_event::wait(std::uint32_t epoch, std::chrono::steady_clock::duration timeout) {
+  if (timeout <= std::chrono::steady_clock::duration::zero())
+    return;
+
+  auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  timespec relative_timeout;
+  relative_timeout.tv_sec = seconds.count();
+  relative_timeout.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds).count();
+
+  // Returns right away if the epoch has already changed
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&epoch_), FUTEX_WAIT_PRIVATE, epoch, &relative_timeout, nullptr, 0);
+}
+
+void wakeup_event::signal() {
+  epoch_.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void wakeup_event::signal_all() {
+  epoch_.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE, std::numeric_limits<int>::max(), nullptr, nullptr, 0);
+}
+
+#else
+
+void wakeup_event::wait(std::uint32_t epoch, std::chrono::steady_clock::duration timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait_for(lock, timeout, [&] {return epoch_.load(std::memory_order_acquire) != epoch; });
+}
+
+void wakeup_event::signal() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    epoch_.fetch_add(1, std::memory_order_release);
+  }
+
+  cv_.notify_one();
+}
+
+void wakeup_event::signal_all() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    epoch_.fetch_add(1, std::memory_order_release);
+  }
+
+  cv_.notify_all();
+}
+
+#endif
+
+}
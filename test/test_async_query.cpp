@@ -10,8 +10,12 @@
 #include <minicomps/executor.h>
 #include <minicomps/testing.h>
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <optional>
+#include <thread>
+#include <vector>
 
 using namespace testing;
 using namespace mc;
@@ -22,6 +26,7 @@ DECLARE_QUERY(Sum, int(int, int)); DEFINE_QUERY(Sum);
 DECLARE_QUERY(Print, void(int)); DEFINE_QUERY(Print);
 DECLARE_QUERY(SaveCallbackResult, void()); DEFINE_QUERY(SaveCallbackResult);
 DECLARE_QUERY(FlowControlledFunction, void()); DEFINE_QUERY(FlowControlledFunction);
+DECLARE_QUERY(Urgent, void()); DEFINE_QUERY(Urgent);
 
 class recording_listener : public component_listener {
 public:
@@ -62,6 +67,7 @@ public:
     publish_async_query<SaveCallbackResult>(&recv_component::save_callback_result);
     publish_async_query<Print>(&recv_component::print);
     publish_async_query<FlowControlledFunction>(&recv_component::flow_controlled_function, flow_executor);
+    publish_async_query<Urgent>(&recv_component::urgent, nullptr, lane::CONTROL);
   }
 
   void print(int val, callback_result<void>&& result) {
@@ -78,9 +84,15 @@ public:
     result({});
   }
 
+  void urgent(callback_result<void>&& result) {
+    urgent_called_after_print = print_called_with != 0;
+    result({});
+  }
+
   std::shared_ptr<callback_result<void>> saved_callback_result;
 
   bool called = false;
+  bool urgent_called_after_print = false;
   int print_called_with = 0;
   bool flow_function_called = false;
   executor_ptr flow_executor = std::make_shared<executor>();
@@ -102,6 +114,18 @@ public:
   async_query<FlowControlledFunction> flow_controlled_function;
 };
 
+class lane_send_component : public component_base<lane_send_component> {
+public:
+  lane_send_component(broker& broker, executor_ptr executor)
+    : component_base("lane_sender", broker, executor)
+    , print(lookup_async_query<Print>())
+    , urgent(lookup_async_query<Urgent>())
+    {}
+
+  async_query<Print> print;
+  async_query<Urgent> urgent;
+};
+
 // TODO: what happens if we call a message that no one receives?
 // TODO: reachable
 // TODO: call a function returning a coroutine
@@ -153,6 +177,134 @@ TEST(async_query, different_executor_enqueues_on_executors) {
   ASSERT_EQ(response, 999);
 }
 
+TEST(async_query, overloaded_receiver_fails_query_through_callback) {
+  // Given
+  broker broker;
+  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>();
+  receiver_executor->limit_queue(1, overflow_policy::FAIL_QUERIES);
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, sender_executor);
+  auto receiver = registry.create<recv_component>(broker, receiver_executor);
+  int response = 0;
+  int error = 0;
+
+  sender->sum.call(1, 2)
+    .with_callback([&] (mc::concrete_result<int> result) {response = *result.get_value(); });
+
+  // When
+  sender->sum.call(3, 4)
+    .with_callback([&] (mc::concrete_result<int> result) {error = result.get_failure()->error; });
+
+  ASSERT_EQ(error, 0);
+  sender_executor->execute();
+
+  // Then
+  ASSERT_EQ(error, query_error::overloaded);
+  ASSERT_EQ(receiver_executor->stats().rejected_queries, 1u);
+
+  receiver_executor->execute();
+  sender_executor->execute();
+  ASSERT_EQ(response, 3);
+}
+
+TEST(async_query, request_past_its_deadline_times_out_without_running_handler) {
+  // Given
+  broker broker;
+  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, sender_executor);
+  auto receiver = registry.create<recv_component>(broker, receiver_executor);
+  int response = 0;
+  int error = 0;
+
+  sender->sum.call(1, 2)
+    .with_deadline(std::chrono::steady_clock::now())
+    .with_callback([&] (mc::concrete_result<int> result) {error = result.get_failure()->error; });
+
+  sender->sum.call(3, 4)
+    .with_timeout(std::chrono::hours(1))
+    .with_callback([&] (mc::concrete_result<int> result) {response = *result.get_value(); });
+
+  // When
+  receiver_executor->execute();
+  sender_executor->execute();
+
+  // Then
+  ASSERT_EQ(error, query_error::timed_out);
+  ASSERT_EQ(response, 7);
+  ASSERT_EQ(receiver_executor->stats().expired_requests, 1u);
+  ASSERT_EQ(receiver_executor->stats().executed_tasks, 2u);
+}
+
+TEST(async_query, canceled_request_is_skipped_without_running_handler) {
+  // Given
+  broker broker;
+  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, sender_executor);
+  auto receiver = registry.create<recv_component>(broker, receiver_executor);
+  auto argument = std::make_shared<int>(5);
+  bool returned = false;
+
+  {
+    lifetime life;
+
+    sender->sum.call(*argument, 2)
+      .with_lifetime(life)
+      .with_callback([&, argument] (mc::concrete_result<int>) {returned = true; });
+  }
+
+  // When
+  receiver_executor->execute();
+  sender_executor->execute();
+
+  // Then
+  ASSERT_FALSE(receiver->called);
+  ASSERT_FALSE(returned);
+  ASSERT_EQ(argument.use_count(), 1);
+  ASSERT_EQ(receiver_executor->stats().canceled_requests, 1u);
+}
+
+TEST(async_query, canceled_request_in_long_queue_triggers_compaction) {
+  // Given
+  broker broker;
+  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, sender_executor);
+  auto receiver = registry.create<recv_component>(broker, receiver_executor);
+  const int num_requests = 2 * executor::compaction_threshold;
+  int responses = 0;
+
+  {
+    lifetime session;
+
+    for (int i = 0; i < num_requests; ++i) {
+      sender->sum.call(i, 1)
+        .with_lifetime(session)
+        .with_callback([&] (mc::concrete_result<int>) {++responses; });
+    }
+  }
+
+  sender->sum.call(1, 2)
+    .with_callback([&] (mc::concrete_result<int>) {++responses; });
+
+  // When
+  receiver_executor->execute(1);
+  receiver_executor->execute();
+  sender_executor->execute();
+
+  // Then
+  executor_stats stats = receiver_executor->stats();
+  ASSERT_EQ(responses, 1);
+  ASSERT_EQ(stats.canceled_requests, static_cast<std::uint64_t>(num_requests));
+  ASSERT_EQ(stats.compacted_tasks, static_cast<std::uint64_t>(num_requests - 1));
+  ASSERT_EQ(stats.executed_tasks, 2u);
+}
+
 TEST(async_query, can_call_query_returning_void) {
   // Given
   broker broker;
@@ -216,7 +368,7 @@ TEST(async_query, lifetime_expiration_stops_callback) {
 
   // Then
   ASSERT_FALSE(returned);
-  ASSERT_EQ(receiver->print_called_with, 432);
+  ASSERT_EQ(receiver->print_called_with, 0);
 }
 
 TEST(async_query, cancellation_status_is_propagated_to_callback_result_and_works) {
@@ -263,9 +415,80 @@ TEST(async_query, with_custom_executor_triggers_function_later) {
   ASSERT_TRUE(receiver->flow_function_called);
 }
 
+TEST(async_query, request_in_higher_lane_overtakes_earlier_requests) {
+  // Given
+  broker broker;
+  executor_ptr sender_exec = std::make_shared<executor>();
+  executor_ptr receiver_exec = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<lane_send_component>(broker, sender_exec);
+  auto receiver = registry.create<recv_component>(broker, receiver_exec);
+  std::vector<int> responses;
+
+  // When
+  sender->print.call(int{123}).with_callback([&] (mc::concrete_result<void>&&) {responses.push_back(1); });
+  sender->urgent.call().with_callback([&] (mc::concrete_result<void>&&) {responses.push_back(2); });
+  receiver_exec->execute();
+  sender_exec->execute();
+
+  // Then
+  ASSERT_FALSE(receiver->urgent_called_after_print);
+  ASSERT_EQ(receiver->print_called_with, 123);
+  ASSERT_EQ(responses.size(), 2);
+  ASSERT_EQ(responses[0], 2); // The urgent response is enqueued in the control lane
+  ASSERT_EQ(responses[1], 1);
+}
+
 // TODO: test async call for function with customized executor but components are on different executors
 // TODO: test sync call for function with customized executor
 
+TEST(async_query, published_handlers_are_looked_up_without_locking_the_receiver) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  component_registry registry;
+  auto receiver = registry.create<recv_component>(broker, exec);
+  std::atomic<bool> held{false};
+  std::atomic<bool> release{false};
+
+  // Holds the receiver's lock for a while, as a long synchronous call from another thread would
+  std::thread holder([&] {
+    std::lock_guard<std::recursive_mutex> lg(receiver->lock);
+    held = true;
+
+    const auto give_up_at = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+    while (!release && std::chrono::steady_clock::now() < give_up_at)
+      std::this_thread::yield();
+  });
+
+  while (!held)
+    std::this_thread::yield();
+
+  // When
+  component& target = *receiver;
+  const auto start = std::chrono::steady_clock::now();
+  void* sum_handler = target.lookup_async_handler(mc::get_message_id<Sum>());
+  executor_ptr flow_executor = target.lookup_executor_override(mc::get_message_id<FlowControlledFunction>());
+  lane urgent_lane = target.lookup_lane(mc::get_message_id<Urgent>());
+  void* missing_handler = target.lookup_sync_handler(mc::get_message_id<Sum>());
+  bool waited_for_lock = std::chrono::steady_clock::now() - start > std::chrono::seconds(1);
+
+  release = true;
+  holder.join();
+
+  // Then
+  bool found_handler = sum_handler != nullptr;
+  bool found_executor = flow_executor == receiver->flow_executor;
+  bool found_lane = urgent_lane == lane::CONTROL;
+  bool missing_not_found = missing_handler == nullptr;
+  ASSERT_FALSE(waited_for_lock);
+  ASSERT_TRUE(found_handler);
+  ASSERT_TRUE(found_executor);
+  ASSERT_TRUE(found_lane);
+  ASSERT_TRUE(missing_not_found);
+}
+
 TEST(async_query, looked_up_queries_show_up_in_dependencies) {
   broker broker;
   executor_ptr exec = std::make_shared<executor>();
@@ -277,6 +500,53 @@ TEST(async_query, looked_up_queries_show_up_in_dependencies) {
   ASSERT_EQ(deps.size(), 4);
 
 }
+TEST(async_query, republished_handlers_are_looked_up_without_locking_the_receiver) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, exec);
+  auto receiver = registry.create<recv_component>(broker, exec);
+  std::atomic<bool> held{false};
+  std::atomic<bool> release{false};
+
+  // When
+  for (int i = 0; i < 3; ++i) {
+    receiver->unpublish_dependencies();
+    receiver->publish_dependencies();
+  }
+
+  std::thread holder([&] {
+    std::lock_guard<std::recursive_mutex> lg(receiver->lock);
+    held = true;
+
+    const auto give_up_at = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+    while (!release && std::chrono::steady_clock::now() < give_up_at)
+      std::this_thread::yield();
+  });
+
+  while (!held)
+    std::this_thread::yield();
+
+  component& target = *receiver;
+  const auto start = std::chrono::steady_clock::now();
+  void* sum_handler = target.lookup_async_handler(mc::get_message_id<Sum>());
+  bool waited_for_lock = std::chrono::steady_clock::now() - start > std::chrono::seconds(1);
+
+  release = true;
+  holder.join();
+
+  int response = 0;
+  sender->sum.call(1, 2).with_callback([&] (mc::concrete_result<int> result) {response = *result.get_value(); });
+
+  // Then
+  bool found_handler = sum_handler != nullptr;
+  ASSERT_FALSE(waited_for_lock);
+  ASSERT_TRUE(found_handler);
+  ASSERT_EQ(response, 3);
+}
+
 // TODO: more extensive callback testing
 }
 
@@ -125,53 +125,78 @@ TEST(async_query_perf, simple_different_executor_same_thread) {
       exec1->execute();
       exec2->execute();
     }
-  });
+  }, {exec1, exec2});
 
   // 589 ms on my computer, = 3 396 000/s
 }
 
-TEST(async_query_perf, spsc_mt_one_producer) {
+void run_spsc_one_producer(queue_type type, bool block_receiver = false) {
   // Given
   broker broker;
   component_registry registry;
-  executor_ptr receiver_executor = std::make_shared<executor>();
-  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>(type);
+  executor_ptr sender_executor = std::make_shared<executor>(type);
 
   auto receiver = registry.create<recv_component>(broker, receiver_executor);
   auto sender = registry.create<send_component>(broker, sender_executor);
 
   // When/Then
-  std::thread receiver_thread([receiver, receiver_executor] {
+  std::thread receiver_thread([receiver, receiver_executor, block_receiver] {
     while (!receiver->done) {
+      if (block_receiver)
+        receiver_executor->wait_for_work(std::chrono::milliseconds(1));
+
       receiver_executor->execute();
     }
   });
 
-  std::thread sender_thread([sender, sender_executor] {
+  std::thread sender_thread([sender, sender_executor, receiver_executor] {
     measure_with_allocs([&] {
       while (!sender->done()) {
         sender->send_update(0);
         sender_executor->execute();
       }
-    });
+    }, {sender_executor, receiver_executor});
   });
 
   sender_thread.join();
 
   receiver->done = true;
   receiver_thread.join();
+}
+
+TEST(async_query_perf, spsc_mt_one_producer) {
+  run_spsc_one_producer(queue_type::LOCKING);
   // 712 ms on my computer, = 2 808 000/s
 }
 
-TEST(async_query_perf, mpsc_mt_three_producers) {
+TEST(async_query_perf, spsc_mt_one_producer_channels) {
+  run_spsc_one_producer(queue_type::SPSC_CHANNELS);
+  // 492 ms on my computer, = 4 065 000/s; 548 ms for LOCKING in the same run
+}
+
+TEST(async_query_perf, spsc_mt_one_producer_blocking_receiver) {
+  run_spsc_one_producer(queue_type::LOCKING, true);
+  // 540 ms on my computer, = 3 704 000/s; 548 ms without blocking in the same run
+}
+
+TEST(async_query_perf, spsc_mt_one_producer_channels_blocking_receiver) {
+  run_spsc_one_producer(queue_type::SPSC_CHANNELS, true);
+  // 473 ms on my computer, = 4 228 000/s; 492 ms without blocking in the same run
+}
+
+void run_mpsc_three_producers(queue_type type, bool stage_responses = false) {
   // Given
   broker broker;
-  executor_ptr exec1 = std::make_shared<executor>();
-  executor_ptr exec2 = std::make_shared<executor>();
-  executor_ptr exec3 = std::make_shared<executor>();
-  executor_ptr exec4 = std::make_shared<executor>();
+  executor_ptr exec1 = std::make_shared<executor>(type);
+  executor_ptr exec2 = std::make_shared<executor>(type);
+  executor_ptr exec3 = std::make_shared<executor>(type);
+  executor_ptr exec4 = std::make_shared<executor>(type);
   component_registry registry;
 
+  if (stage_responses)
+    exec1->enable_outbound_staging();
+
   auto receiver = registry.create<recv_component>(broker, exec1);
 
   // When/Then
@@ -184,14 +209,14 @@ TEST(async_query_perf, mpsc_mt_three_producers) {
       exec1->execute();
   });
 
-  std::thread t2([sender1, exec2] {
+  std::thread t2([sender1, exec1, exec2] {
     measure_with_allocs([&] {
       int i = 50000000;
       while (!sender1->done()) {
         sender1->send_update(i++);
         exec2->execute();
       }
-    });
+    }, {exec1, exec2});
   });
 
   std::thread t3([sender2, exec3] {
@@ -216,8 +241,26 @@ TEST(async_query_perf, mpsc_mt_three_producers) {
 
   receiver->done = true;
   t1.join();
+}
+
+TEST(async_query_perf, mpsc_mt_three_producers) {
+  run_mpsc_three_producers(queue_type::LOCKING);
   // 1413 ms on my computer, = 1 415 000/s
 }
 
+TEST(async_query_perf, mpsc_mt_three_producers_lock_free) {
+  run_mpsc_three_producers(queue_type::LOCK_FREE_MPSC);
+  // 2056 ms on my computer, = 973 000/s; 1888 ms for LOCKING in the same run
+}
+
+TEST(async_query_perf, mpsc_mt_three_producers_channels) {
+  run_mpsc_three_producers(queue_type::SPSC_CHANNELS);
+  // 1648 ms on my computer, = 1 214 000/s; 1888 ms for LOCKING in the same run
 }
 
+TEST(async_query_perf, mpsc_mt_three_producers_staged_responses) {
+  run_mpsc_three_producers(queue_type::LOCKING, true);
+  // 1733 ms on my computer, = 1 154 000/s; 1888 ms without staging in the same run
+}
+
+}
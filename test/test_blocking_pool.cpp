@@ -0,0 +1,217 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicoros/coroutine.h>
+#include <minicomps/blocking_pool.h>
+#include <minicomps/broker.h>
+#include <minicomps/component_base.h>
+#include <minicomps/executor.h>
+#include <minicomps/messaging.h>
+#include <minicomps/testing.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+DECLARE_QUERY(ReadFile, int(int)); DEFINE_QUERY(ReadFile);
+
+class offloading_component : public component_base<offloading_component> {
+public:
+  offloading_component(broker& broker, executor_ptr executor)
+    : component_base("offloader", broker, executor)
+    {}
+
+  template<typename JobType>
+  auto run_blocking(blocking_pool& pool, JobType job) {
+    return offload(pool, std::move(job));
+  }
+
+  template<typename R, typename JobType, typename CallbackType>
+  void submit_blocking(blocking_pool& pool, JobType job, CallbackType callback) {
+    pool.submit(std::move(job), callback_result<R>{executor_ptr(default_executor), default_lifetime.create_weak_ptr(), this, this, blocking_job_info, std::move(callback)});
+  }
+};
+
+class file_component : public component_base<file_component> {
+public:
+  file_component(broker& broker, executor_ptr executor, blocking_pool& pool)
+    : component_base("file", broker, executor)
+    , pool_(pool)
+    {}
+
+  virtual void publish() override {
+    publish_async_query<ReadFile>([this] (int size, callback_result<int>&& result) {
+      pool_.submit([size] {return size * 2; }, std::move(result));
+    });
+  }
+
+private:
+  blocking_pool& pool_;
+};
+
+class reader_component : public component_base<reader_component> {
+public:
+  reader_component(broker& broker, executor_ptr executor)
+    : component_base("reader", broker, executor)
+    , read_file(lookup_async_query<ReadFile>())
+    {}
+
+  async_query<ReadFile> read_file;
+};
+
+/// Keeps the pool's workers busy until released
+struct worker_gate {
+  void hold(blocking_pool& pool, offloading_component& component) {
+    component.submit_blocking<void>(pool, [this] {
+      started = true;
+
+      while (!released)
+        std::this_thread::yield();
+    }, [] (concrete_result<void>&&) {});
+
+    while (!started)
+      std::this_thread::yield();
+  }
+
+  std::atomic<bool> started{false};
+  std::atomic<bool> released{false};
+};
+
+void execute_until(executor& exec, const bool& done) {
+  const auto give_up_at = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+  while (!done && std::chrono::steady_clock::now() < give_up_at) {
+    exec.wait_for_work(std::chrono::milliseconds(10));
+    exec.execute();
+  }
+}
+
+}
+
+TEST(blocking_pool, offloaded_job_runs_on_worker_and_resolves_on_callers_executor) {
+  // Given
+  broker broker;
+  auto exec = std::make_shared<executor>();
+  offloading_component component(broker, exec);
+  blocking_pool pool(1);
+
+  std::atomic<std::thread::id> job_thread;
+  std::thread::id resolved_on;
+  int result = 0;
+  bool done = false;
+
+  // When
+  component.run_blocking(pool, [&] {
+    job_thread = std::this_thread::get_id();
+    return 41;
+  }).then([&] (int value) {
+    resolved_on = std::this_thread::get_id();
+    result = value + 1;
+    done = true;
+  });
+
+  execute_until(*exec, done);
+
+  // Then
+  bool ran_on_worker = job_thread.load() != std::this_thread::get_id();
+  bool resolved_on_caller = resolved_on == std::this_thread::get_id();
+  ASSERT_TRUE(ran_on_worker);
+  ASSERT_TRUE(resolved_on_caller);
+  ASSERT_EQ(result, 42);
+  ASSERT_EQ(pool.num_completed_jobs(), 1u);
+}
+
+TEST(blocking_pool, result_of_direct_call_passed_through_resolves_on_callers_executor) {
+  // Given
+  broker broker;
+  auto exec = std::make_shared<executor>();
+  blocking_pool pool(1);
+  component_registry registry;
+  auto files = registry.create<file_component>(broker, exec, pool);
+  auto reader = registry.create<reader_component>(broker, exec);
+
+  std::thread::id resolved_on;
+  int result = 0;
+  bool done = false;
+
+  // When
+  reader->read_file.call(21).with_callback([&] (mc::concrete_result<int> response) {
+    resolved_on = std::this_thread::get_id();
+    result = *response.get_value();
+    done = true;
+  });
+
+  execute_until(*exec, done);
+
+  // Then
+  bool resolved_on_caller = resolved_on == std::this_thread::get_id();
+  ASSERT_TRUE(resolved_on_caller);
+  ASSERT_EQ(result, 42);
+}
+
+TEST(blocking_pool, job_is_skipped_when_caller_goes_away_before_it_starts) {
+  // Given
+  broker broker;
+  auto exec = std::make_shared<executor>();
+  auto gate_owner = std::make_unique<offloading_component>(broker, exec);
+  auto component = std::make_unique<offloading_component>(broker, exec);
+  blocking_pool pool(1);
+  worker_gate gate;
+  std::atomic<int> job_runs{0};
+  int callback_calls = 0;
+
+  gate.hold(pool, *gate_owner);
+  component->submit_blocking<int>(pool, [&] {return ++job_runs; }, [&] (concrete_result<int>&&) {++callback_calls; });
+
+  // When
+  component.reset();
+  gate.released = true;
+
+  const auto give_up_at = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+  while (pool.num_canceled_jobs() == 0 && std::chrono::steady_clock::now() < give_up_at)
+    std::this_thread::yield();
+
+  exec->execute();
+
+  // Then
+  ASSERT_EQ(pool.num_canceled_jobs(), 1u);
+  ASSERT_EQ(job_runs.load(), 0);
+  ASSERT_EQ(callback_calls, 0);
+}
+
+TEST(blocking_pool, fails_jobs_with_overloaded_when_queue_is_full) {
+  // Given
+  broker broker;
+  auto exec = std::make_shared<executor>();
+  offloading_component component(broker, exec);
+  blocking_pool pool(1, 1);
+  worker_gate gate;
+  int error = 0;
+  bool done = false;
+
+  gate.hold(pool, component);
+  component.submit_blocking<int>(pool, [] {return 1; }, [] (concrete_result<int>&&) {});
+
+  // When
+  component.submit_blocking<int>(pool, [] {return 2; }, [&] (concrete_result<int>&& result) {
+    if (auto* failure = result.get_failure())
+      error = failure->error;
+
+    done = true;
+  });
+
+  execute_until(*exec, done);
+  gate.released = true;
+
+  // Then
+  ASSERT_EQ(error, query_error::overloaded);
+  ASSERT_EQ(pool.num_rejected_jobs(), 1u);
+}
@@ -6,12 +6,20 @@
 #include <minicomps/component_base.h>
 #include <minicomps/broker.h>
 #include <minicomps/executor.h>
+#include <minicomps/messaging.h>
 
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <vector>
 
 using namespace testing;
 using namespace mc;
 
+DECLARE_EVENT(FirstMessage, {}); DEFINE_EVENT(FirstMessage);
+DECLARE_EVENT(SecondMessage, {}); DEFINE_EVENT(SecondMessage);
+DECLARE_EVENT(RacedMessage, {}); DEFINE_EVENT(RacedMessage);
+
 class component1 : public component_base<component1> {
 public:
   component1(broker& broker, executor_ptr executor) : component_base("c1", broker, executor) {}
@@ -81,3 +89,286 @@ TEST(broker, disassociating_removes_and_invalidates_existing_sets) {
   ASSERT_TRUE(receivers.expired());
   ASSERT_EQ(broker.lookup(123).lock()->size(), 0);
 }
+
+TEST(broker, disassociating_everything_leaves_other_components_and_messages_alone) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  auto c1 = std::make_shared<component1>(broker, exec);
+  auto c2 = std::make_shared<component1>(broker, exec);
+  broker.associate(123, c1);
+  broker.associate(123, c2);
+  broker.associate(456, c1);
+  broker.associate(789, c2);
+
+  std::weak_ptr<message_receivers> untouched = broker.lookup(789);
+
+  // When
+  broker.disassociate_everything(c1.get());
+
+  // Then
+  ASSERT_EQ(broker.lookup(123).lock()->size(), 1);
+  ASSERT_EQ(broker.lookup(456).lock()->size(), 0);
+  ASSERT_FALSE(untouched.expired());
+}
+
+TEST(broker, disassociating_unknown_message_or_component_does_nothing) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  auto c1 = std::make_shared<component1>(broker, exec);
+  auto c2 = std::make_shared<component1>(broker, exec);
+  broker.associate(123, c1);
+
+  // When
+  broker.disassociate(456, c1.get());
+  broker.disassociate(123, c2.get());
+  broker.disassociate_everything(c2.get());
+
+  // Then
+  ASSERT_EQ(broker.lookup(123).lock()->size(), 1);
+}
+
+TEST(broker, child_resolves_to_parents_receivers_until_it_has_its_own) {
+  // Given
+  broker parent;
+  broker child(parent);
+  executor_ptr exec = std::make_shared<executor>();
+  auto global = std::make_shared<component1>(parent, exec);
+  auto local = std::make_shared<component1>(child, exec);
+  parent.associate(123, global);
+
+  std::weak_ptr<message_receivers> inherited = child.lookup(123);
+
+  // When
+  child.associate(123, local);
+
+  // Then
+  ASSERT_EQ(inherited.lock(), nullptr);
+  bool resolves_locally = child.lookup(123).lock()->at(0).lock() == local;
+  ASSERT_TRUE(resolves_locally);
+  ASSERT_EQ(parent.lookup(123).lock()->size(), 1);
+
+  child.disassociate(123, local.get());
+  bool resolves_to_parent = child.lookup(123).lock()->at(0).lock() == global;
+  ASSERT_TRUE(resolves_to_parent);
+}
+
+TEST(broker, parent_changes_only_invalidate_child_lookups_that_fall_back_to_it) {
+  // Given
+  broker parent;
+  broker child(parent);
+  executor_ptr exec = std::make_shared<executor>();
+  auto global = std::make_shared<component1>(parent, exec);
+  auto local = std::make_shared<component1>(child, exec);
+  child.associate(456, local);
+
+  std::weak_ptr<message_receivers> inherited = child.lookup(123);
+  std::weak_ptr<message_receivers> own = child.lookup(456);
+
+  // When
+  parent.associate(123, global);
+  parent.associate(456, global);
+
+  // Then
+  ASSERT_TRUE(inherited.expired());
+  ASSERT_FALSE(own.expired());
+  ASSERT_EQ(child.lookup(123).lock()->size(), 1);
+  ASSERT_EQ(child.lookup(456).lock()->size(), 1);
+}
+
+TEST(broker, child_changes_dont_invalidate_parent_lookups) {
+  // Given
+  broker parent;
+  broker child(parent);
+  executor_ptr exec = std::make_shared<executor>();
+  auto local = std::make_shared<component1>(child, exec);
+  std::weak_ptr<message_receivers> parent_receivers = parent.lookup(123);
+
+  // When
+  child.associate(123, local);
+  child.invalidate(123);
+  child.disassociate_everything(local.get());
+
+  // Then
+  ASSERT_FALSE(parent_receivers.expired());
+  ASSERT_EQ(parent.lookup(123).lock()->size(), 0);
+}
+
+TEST(broker, grandchildren_see_changes_in_the_root) {
+  // Given
+  broker root;
+  broker child(root);
+  broker grandchild(child);
+  executor_ptr exec = std::make_shared<executor>();
+  auto global = std::make_shared<component1>(root, exec);
+  std::weak_ptr<message_receivers> inherited = grandchild.lookup(123);
+
+  // When
+  root.associate(123, global);
+
+  // Then
+  ASSERT_TRUE(inherited.expired());
+  ASSERT_EQ(grandchild.lookup(123).lock()->size(), 1);
+}
+
+TEST(broker, generation_changes_with_the_message_list_only) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  auto c1 = std::make_shared<component1>(broker, exec);
+  const std::atomic<std::uint64_t>& generation = broker.generation(123);
+  const std::uint64_t initial = generation.load();
+
+  // When/Then
+  broker.associate(456, c1);
+  ASSERT_EQ(generation.load(), initial);
+
+  broker.associate(123, c1);
+  const std::uint64_t associated = generation.load();
+  bool bumped_by_associate = associated != initial;
+  ASSERT_TRUE(bumped_by_associate);
+
+  broker.invalidate(123);
+  bool bumped_by_invalidate = generation.load() != associated;
+  ASSERT_TRUE(bumped_by_invalidate);
+}
+
+TEST(broker, child_generation_follows_parent_only_while_falling_back) {
+  // Given
+  broker parent;
+  broker child(parent);
+  executor_ptr exec = std::make_shared<executor>();
+  auto global = std::make_shared<component1>(parent, exec);
+  auto local = std::make_shared<component1>(child, exec);
+  const std::atomic<std::uint64_t>& generation = child.generation(123);
+  const std::uint64_t initial = generation.load();
+
+  // When/Then
+  parent.associate(123, global);
+  const std::uint64_t inherited = generation.load();
+  bool followed_parent = inherited != initial;
+  ASSERT_TRUE(followed_parent);
+
+  child.associate(123, local);
+  const std::uint64_t own = generation.load();
+  parent.invalidate(123);
+  ASSERT_EQ(generation.load(), own);
+}
+
+TEST(broker, lookups_from_other_threads_see_consistent_lists_while_associations_change) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  auto c1 = std::make_shared<component1>(broker, exec);
+  auto c2 = std::make_shared<component1>(broker, exec);
+  std::atomic<bool> stop{false};
+  std::atomic<int> inconsistent{0};
+  std::vector<std::thread> readers;
+
+  for (int i = 0; i < 3; ++i) {
+    readers.emplace_back([&] {
+      while (!stop) {
+        for (message_id msg_id = 1; msg_id <= 8; ++msg_id) {
+          auto receivers = broker.lookup(msg_id).lock();
+
+          if (receivers && receivers->size() > 2)
+            ++inconsistent;
+        }
+      }
+    });
+  }
+
+  // When
+  for (int round = 0; round < 200; ++round) {
+    for (message_id msg_id = 1; msg_id <= 8; ++msg_id) {
+      broker.associate(msg_id, c1);
+      broker.associate(msg_id, c2);
+    }
+
+    broker.disassociate_everything(c1.get());
+    broker.disassociate_everything(c2.get());
+  }
+
+  stop = true;
+
+  for (auto& reader : readers)
+    reader.join();
+
+  // Then
+  ASSERT_EQ(inconsistent.load(), 0);
+  ASSERT_EQ(broker.lookup(1).lock()->size(), 0);
+}
+
+TEST(broker, large_message_ids_are_kept_apart_from_small_ones) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  std::shared_ptr<component> c1 = std::make_shared<component1>(broker, exec);
+  std::shared_ptr<component> c2 = std::make_shared<component1>(broker, exec);
+  const message_id hashed = 0x9e3779b97f4a7c10u;
+  const message_id address = reinterpret_cast<message_id>(c1.get());
+
+  // When
+  broker.associate(hashed, c1);
+  broker.associate(address, c1);
+  broker.associate(address, c2);
+  broker.associate(hashed & 0xff, c2);
+
+  // Then
+  ASSERT_EQ(broker.lookup(hashed).lock()->size(), 1);
+  ASSERT_EQ(broker.lookup(address).lock()->size(), 2);
+  ASSERT_EQ(broker.lookup(hashed & 0xff).lock()->size(), 1);
+  ASSERT_EQ(broker.lookup(hashed + broker.num_shards()).lock()->size(), 0);
+
+  // When
+  std::weak_ptr<message_receivers> receivers = broker.lookup(address);
+  const std::uint64_t generation = broker.generation(address);
+  broker.disassociate(address, c2.get());
+
+  // Then
+  bool generation_changed = broker.generation(address) != generation;
+  ASSERT_FALSE(receivers.lock());
+  ASSERT_TRUE(generation_changed);
+  ASSERT_EQ(broker.lookup(address).lock()->size(), 1);
+}
+
+TEST(broker, message_ids_are_small_distinct_and_stable) {
+  // Given
+  message_id first = get_message_id<FirstMessage>();
+  message_id second = get_message_id<SecondMessage>();
+
+  // Then
+  bool distinct = first != second;
+  bool dense = first > 0 && second > 0 && first < 10000 && second < 10000;
+  ASSERT_TRUE(distinct);
+  ASSERT_TRUE(dense);
+  ASSERT_EQ(get_message_id<FirstMessage>(), first);
+  ASSERT_EQ(get_message_info<FirstMessage>().id, first);
+}
+
+TEST(broker, threads_racing_for_a_new_message_id_agree_on_it) {
+  // Given
+  std::atomic<bool> go{false};
+  std::vector<message_id> ids(4);
+  std::vector<std::thread> threads;
+
+  for (std::size_t i = 0; i < ids.size(); ++i) {
+    threads.emplace_back([&, i] {
+      while (!go)
+        std::this_thread::yield();
+
+      ids[i] = get_message_id<RacedMessage>();
+    });
+  }
+
+  // When
+  go = true;
+
+  for (auto& thread : threads)
+    thread.join();
+
+  // Then
+  for (message_id id : ids)
+    ASSERT_EQ(id, get_message_id<RacedMessage>());
+}
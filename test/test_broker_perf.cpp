@@ -0,0 +1,104 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicomps/component.h>
+#include <minicomps/component_base.h>
+#include <minicomps/broker.h>
+#include <minicomps/executor.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+class churn_component : public component_base<churn_component> {
+public:
+  churn_component(broker& broker, executor_ptr executor) : component_base("churn", broker, executor) {}
+};
+
+constexpr message_id num_messages = 1024;
+constexpr int lookups_per_thread = 1000000;
+
+/// Lookup threads hammer the broker while another thread keeps associating and disassociating a component, like
+/// during startup or hot-swapping. Every lookup thread does the same amount of work, so lookups/s grow with
+/// the number of threads as long as lookups don't serialize.
+void run_lookups_during_churn(std::size_t num_shards, unsigned num_threads) {
+  // Given
+  broker broker(num_shards);
+  executor_ptr exec = std::make_shared<executor>();
+  auto stable = std::make_shared<churn_component>(broker, exec);
+  auto churning = std::make_shared<churn_component>(broker, exec);
+
+  for (message_id msg_id = 1; msg_id <= num_messages; ++msg_id)
+    broker.associate(msg_id, stable);
+
+  std::atomic<bool> stop_churn{false};
+  std::atomic<int> found{0};
+
+  std::thread churn_thread([&] {
+    for (message_id msg_id = 1; !stop_churn; msg_id = msg_id % num_messages + 1) {
+      broker.associate(msg_id, churning);
+
+      if (msg_id % 16 == 0)
+        broker.disassociate_everything(churning.get());
+    }
+  });
+
+  // When
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> lookup_threads;
+
+  for (unsigned i = 0; i < num_threads; ++i) {
+    lookup_threads.emplace_back([&, i] {
+      int local_found = 0;
+
+      for (int n = 0; n < lookups_per_thread; ++n)
+        local_found += !broker.lookup((n * 7 + i) % num_messages + 1).expired();
+
+      found += local_found;
+    });
+  }
+
+  for (auto& thread : lookup_threads)
+    thread.join();
+
+  const auto duration = std::chrono::steady_clock::now() - start;
+  stop_churn = true;
+  churn_thread.join();
+
+  // Then
+  const auto duration_us = std::max<std::int64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+  const std::int64_t total_lookups = std::int64_t{lookups_per_thread} * num_threads;
+
+  std::cout << num_shards << " shards, " << num_threads << " threads: " << duration_us / 1000 << " ms, "
+            << total_lookups * 1000000 / duration_us << " lookups/s" << std::endl;
+
+  bool found_receivers = found > 0;
+  ASSERT_TRUE(found_receivers);
+}
+
+}
+
+TEST(broker_perf, lookups_during_churn) {
+  const unsigned max_threads = std::min(8u, std::max(2u, std::thread::hardware_concurrency()));
+
+  for (std::size_t num_shards : {1, 16}) {
+    for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+      run_lookups_during_churn(num_shards, num_threads);
+  }
+
+  // On my computer (one core, so two threads only take turns):
+  //   1 shard, 1 thread: 64 ms, 15 445 000 lookups/s
+  //   1 shard, 2 threads: 94 ms, 21 231 000 lookups/s
+  //   16 shards, 1 thread: 57 ms, 17 442 000 lookups/s
+  //   16 shards, 2 threads: 86 ms, 23 212 000 lookups/s
+}
@@ -74,6 +74,80 @@ TEST(event, events_can_be_received) {
   ASSERT_EQ(receiver->received_event->term1, 10);
 }
 
+TEST(event, receivers_subscribing_after_an_event_without_subscribers_get_later_events) {
+  // Given
+  broker broker;
+  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, sender_executor);
+  sender->summation_finished({1, 2, 3}); // Caches that there are no subscribers
+
+  // When
+  auto receiver = registry.create<recv_component>(broker, receiver_executor);
+  sender->summation_finished({10, 5, 15});
+  receiver_executor->execute();
+
+  // Then
+  ASSERT_TRUE(!!receiver->received_event);
+  ASSERT_EQ(receiver->received_event->term1, 10);
+}
+
+TEST(event, receivers_sharing_an_executor_all_get_a_copy) {
+  // Given
+  broker broker;
+  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>();
+  executor_ptr other_executor = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, sender_executor);
+  auto first = registry.create<recv_component>(broker, receiver_executor);
+  auto other = registry.create<recv_component>(broker, other_executor);
+  auto second = registry.create<recv_component>(broker, receiver_executor);
+
+  // When
+  SummationFinished event;
+  event.term1 = 10;
+  event.term2 = 5;
+  event.sum = 15;
+  sender->summation_finished(std::move(event));
+  receiver_executor->execute();
+
+  // Then
+  ASSERT_TRUE(!!first->received_event);
+  ASSERT_TRUE(!!second->received_event);
+  ASSERT_FALSE(!!other->received_event);
+  ASSERT_EQ(first->received_event->sum, 15);
+  ASSERT_EQ(second->received_event->sum, 15);
+
+  other_executor->execute();
+  ASSERT_EQ(other->received_event->sum, 15);
+}
+
+TEST(event, full_executor_drops_events) {
+  // Given
+  broker broker;
+  executor_ptr sender_executor = std::make_shared<executor>();
+  executor_ptr receiver_executor = std::make_shared<executor>();
+  receiver_executor->limit_queue(1, overflow_policy::DROP_EVENTS);
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, sender_executor);
+  auto receiver = registry.create<recv_component>(broker, receiver_executor);
+
+  // When
+  for (int sum = 1; sum <= 3; ++sum) {
+    SummationFinished event;
+    event.sum = sum;
+    sender->summation_finished(std::move(event));
+  }
+
+  receiver_executor->execute();
+
+  // Then
+  ASSERT_EQ(receiver->received_event->sum, 1);
+  ASSERT_EQ(receiver_executor->stats().dropped_events, 2u);
+}
+
 // TODO: tests for listeners
 
 }
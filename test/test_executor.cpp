@@ -0,0 +1,1248 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicomps/executor.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+struct sequence_number {
+  int producer;
+  int value;
+};
+
+struct cancelable_number {
+  int value;
+  bool is_canceled;
+
+  bool canceled() const {
+    return is_canceled;
+  }
+};
+
+const queue_type all_queue_types[] = {queue_type::LOCKING, queue_type::LOCK_FREE_MPSC, queue_type::SPSC_CHANNELS};
+
+}
+
+TEST(executor, lock_free_executes_in_order) {
+  // Given
+  executor exec(queue_type::LOCK_FREE_MPSC, 4);
+  std::vector<int> executed;
+
+  // When
+  for (int i = 0; i < 3; ++i) {
+    exec.enqueue_work([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, int{i});
+  }
+
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(executed.size(), 3);
+  ASSERT_EQ(executed[0], 0);
+  ASSERT_EQ(executed[1], 1);
+  ASSERT_EQ(executed[2], 2);
+}
+
+TEST(executor, lock_free_keeps_order_when_ring_overflows) {
+  // Given
+  executor exec(queue_type::LOCK_FREE_MPSC, 4);
+  std::vector<int> executed;
+
+  // When
+  for (int i = 0; i < 10; ++i) {
+    exec.enqueue_work([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, int{i});
+  }
+
+  exec.execute();
+
+  for (int i = 10; i < 20; ++i) {
+    exec.enqueue_work([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, int{i});
+  }
+
+  exec.execute();
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(executed.size(), 20);
+
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_EQ(executed[i], i);
+  }
+}
+
+TEST(executor, lock_free_defers_work_enqueued_during_execute) {
+  // Given
+  executor exec(queue_type::LOCK_FREE_MPSC, 4);
+  int executed = 0;
+
+  exec.enqueue_work([&] (void*) {
+    ++executed;
+    exec.enqueue_work([&] (void*) {++executed; }, 0);
+  }, 0);
+
+  // When
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(executed, 1);
+  exec.execute();
+  ASSERT_EQ(executed, 2);
+}
+
+TEST(executor, lock_free_destroys_unexecuted_work) {
+  // Given
+  auto data = std::make_shared<int>(123);
+
+  {
+    executor exec(queue_type::LOCK_FREE_MPSC, 4);
+
+    // When
+    for (int i = 0; i < 10; ++i) {
+      exec.enqueue_work([] (void*) {}, std::shared_ptr<int>(data));
+    }
+
+    ASSERT_EQ(data.use_count(), 11);
+  }
+
+  // Then
+  ASSERT_EQ(data.use_count(), 1);
+}
+
+TEST(executor, lock_free_keeps_order_per_producer_across_threads) {
+  // Given
+  const int num_producers = 3;
+  const int num_items = 200000;
+  executor exec(queue_type::LOCK_FREE_MPSC, 64);
+  std::vector<int> last_seen(num_producers, -1);
+  int total_executed = 0;
+  bool out_of_order = false;
+
+  // When
+  std::vector<std::thread> producers;
+
+  for (int producer = 0; producer < num_producers; ++producer) {
+    producers.emplace_back([&, producer] {
+      for (int i = 0; i < num_items; ++i) {
+        exec.enqueue_work([&] (void* data) {
+          sequence_number& number = *static_cast<sequence_number*>(data);
+          if (number.value != last_seen[number.producer] + 1)
+            out_of_order = true;
+
+          last_seen[number.producer] = number.value;
+          ++total_executed;
+        }, sequence_number{producer, i});
+      }
+    });
+  }
+
+  while (total_executed < num_producers * num_items)
+    exec.execute();
+
+  for (auto& producer : producers)
+    producer.join();
+
+  // Then
+  ASSERT_FALSE(out_of_order);
+  ASSERT_EQ(total_executed, num_producers * num_items);
+}
+
+TEST(executor, lock_free_grows_by_segments_while_nothing_is_consumed) {
+  // Given
+  const int num_producers = 3;
+  const int num_items = 999;
+  executor exec(queue_type::LOCK_FREE_MPSC, 8);
+  std::vector<int> last_seen(num_producers, -1);
+  int total_executed = 0;
+  bool out_of_order = false;
+
+  // When
+  std::vector<std::thread> producers;
+
+  for (int producer = 0; producer < num_producers; ++producer) {
+    producers.emplace_back([&, producer] {
+      for (int i = 0; i < num_items; i += 3) {
+        exec.enqueue_batch(3, lane::NORMAL, [&] (std::size_t index, auto&& enqueue) {
+          enqueue([&] (void* data) {
+            auto& number = *static_cast<sequence_number*>(data);
+            out_of_order |= number.value != last_seen[number.producer] + 1;
+            last_seen[number.producer] = number.value;
+            ++total_executed;
+          }, sequence_number{producer, i + static_cast<int>(index)});
+        });
+      }
+    });
+  }
+
+  for (auto& producer : producers)
+    producer.join();
+
+  exec.execute();
+
+  // Then
+  ASSERT_FALSE(out_of_order);
+  ASSERT_EQ(total_executed, num_producers * num_items);
+}
+
+TEST(executor, channels_execute_in_order) {
+  // Given
+  executor exec(queue_type::SPSC_CHANNELS);
+  std::vector<int> executed;
+
+  // When
+  for (int i = 0; i < 1000; ++i) {
+    exec.enqueue_work([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, int{i});
+  }
+
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(executed.size(), 1000);
+
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(executed[i], i);
+  }
+}
+
+TEST(executor, channels_defer_work_enqueued_during_execute) {
+  // Given
+  executor exec(queue_type::SPSC_CHANNELS);
+  int executed = 0;
+
+  exec.enqueue_work([&] (void*) {
+    ++executed;
+    exec.enqueue_work([&] (void*) {++executed; }, 0);
+  }, 0);
+
+  // When
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(executed, 1);
+  exec.execute();
+  ASSERT_EQ(executed, 2);
+}
+
+TEST(executor, channels_destroy_unexecuted_work) {
+  // Given
+  auto data = std::make_shared<int>(123);
+
+  {
+    executor exec(queue_type::SPSC_CHANNELS);
+
+    // When
+    for (int i = 0; i < 1000; ++i) {
+      exec.enqueue_work([] (void*) {}, std::shared_ptr<int>(data));
+    }
+
+    ASSERT_EQ(data.use_count(), 1001);
+  }
+
+  // Then
+  ASSERT_EQ(data.use_count(), 1);
+}
+
+TEST(executor, channels_keep_order_per_producer_across_threads) {
+  // Given
+  const int num_producers = 3;
+  const int num_items = 200000;
+  executor exec(queue_type::SPSC_CHANNELS);
+  std::vector<int> last_seen(num_producers, -1);
+  int total_executed = 0;
+  bool out_of_order = false;
+
+  // When
+  std::vector<std::thread> producers;
+
+  for (int producer = 0; producer < num_producers; ++producer) {
+    producers.emplace_back([&, producer] {
+      for (int i = 0; i < num_items; ++i) {
+        exec.enqueue_work([&] (void* data) {
+          sequence_number& number = *static_cast<sequence_number*>(data);
+          if (number.value != last_seen[number.producer] + 1)
+            out_of_order = true;
+
+          last_seen[number.producer] = number.value;
+          ++total_executed;
+        }, sequence_number{producer, i});
+      }
+    });
+  }
+
+  while (total_executed < num_producers * num_items)
+    exec.execute();
+
+  for (auto& producer : producers)
+    producer.join();
+
+  // Then
+  ASSERT_FALSE(out_of_order);
+  ASSERT_EQ(total_executed, num_producers * num_items);
+}
+
+TEST(executor, wait_for_work_times_out_without_work) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    auto start = std::chrono::steady_clock::now();
+
+    // When
+    bool has_work = exec.wait_for_work(std::chrono::milliseconds(20));
+
+    // Then
+    bool waited = std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20);
+    ASSERT_FALSE(has_work);
+    ASSERT_TRUE(waited);
+  }
+}
+
+TEST(executor, wait_for_work_returns_right_away_with_queued_work) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    int executed = 0;
+    exec.enqueue_work([&] (void*) {++executed; }, 0);
+
+    // When
+    bool has_work = exec.wait_for_work(std::chrono::seconds(10));
+
+    // Then
+    ASSERT_TRUE(has_work);
+    exec.execute();
+    ASSERT_EQ(executed, 1);
+    ASSERT_FALSE(exec.wait_for_work(std::chrono::steady_clock::duration::zero()));
+  }
+}
+
+TEST(executor, wait_for_work_wakes_up_when_work_is_enqueued) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    int executed = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      exec.enqueue_work([&] (void*) {++executed; }, 0);
+    });
+
+    // When
+    bool has_work = exec.wait_for_work(std::chrono::seconds(10));
+    bool woke_up_early = std::chrono::steady_clock::now() - start < std::chrono::seconds(5);
+    producer.join();
+
+    // Then
+    ASSERT_TRUE(has_work);
+    ASSERT_TRUE(woke_up_early);
+    exec.execute();
+    ASSERT_EQ(executed, 1);
+  }
+}
+
+TEST(executor, wait_for_work_never_misses_a_wakeup) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    const int num_items = 100000;
+    executor exec(type);
+    int executed = 0;
+    bool timed_out = false;
+
+    std::thread producer([&] {
+      for (int i = 0; i < num_items; ++i) {
+        exec.enqueue_work([&] (void*) {++executed; }, 0);
+
+        if (i % 64 == 0)
+          std::this_thread::yield();
+      }
+    });
+
+    // When
+    while (executed < num_items && !timed_out) {
+      timed_out = !exec.wait_for_work(std::chrono::seconds(10));
+      exec.execute();
+    }
+
+    producer.join();
+
+    // Then
+    ASSERT_FALSE(timed_out);
+    ASSERT_EQ(executed, num_items);
+  }
+}
+
+TEST(executor, budgeted_execute_leaves_remaining_work_queued_in_order) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type, 4);
+    std::vector<int> executed;
+
+    for (int i = 0; i < 10; ++i) {
+      exec.enqueue_work([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, int{i});
+    }
+
+    // When
+    std::size_t first_pass = exec.execute(3);
+
+    for (int i = 10; i < 15; ++i) {
+      exec.enqueue_work([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, int{i});
+    }
+
+    std::size_t second_pass = exec.execute(4);
+
+    while (exec.execute(2) > 0) {}
+
+    // Then
+    ASSERT_EQ(first_pass, 3);
+    ASSERT_EQ(second_pass, 4);
+    ASSERT_EQ(executed.size(), 15);
+
+    for (int i = 0; i < 15; ++i) {
+      ASSERT_EQ(executed[i], i);
+    }
+  }
+}
+
+TEST(executor, budgeted_execute_stops_at_deadline) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    int executed = 0;
+
+    for (int i = 0; i < 10; ++i) {
+      exec.enqueue_work([&] (void*) {
+        ++executed;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }, 0);
+    }
+
+    // When
+    std::size_t expired_pass = exec.execute(100, std::chrono::steady_clock::now() - std::chrono::seconds(1));
+    std::size_t timed_pass = exec.execute(100, std::chrono::steady_clock::now() + std::chrono::milliseconds(12));
+
+    // Then
+    ASSERT_EQ(expired_pass, 0);
+    bool stopped_early = timed_pass >= 1 && timed_pass < 10;
+    ASSERT_TRUE(stopped_early);
+    ASSERT_EQ(executed, static_cast<int>(timed_pass));
+    ASSERT_TRUE(exec.wait_for_work(std::chrono::steady_clock::duration::zero()));
+
+    exec.execute();
+    ASSERT_EQ(executed, 10);
+  }
+}
+
+TEST(executor, try_execute_runs_work_when_uncontended) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    int executed = 0;
+
+    for (int i = 0; i < 5; ++i) {
+      exec.enqueue_work([&] (void*) {++executed; }, 0);
+    }
+
+    // When
+    bool got_queue = exec.try_execute(2);
+
+    // Then
+    ASSERT_TRUE(got_queue);
+    ASSERT_EQ(executed, 2);
+    ASSERT_TRUE(exec.try_execute());
+    ASSERT_EQ(executed, 5);
+  }
+}
+
+TEST(executor, try_execute_keeps_order_under_contention) {
+  // Given
+  const int num_items = 200000;
+  executor exec;
+  int last_seen = -1;
+  int total_executed = 0;
+  bool out_of_order = false;
+
+  std::thread producer([&] {
+    for (int i = 0; i < num_items; ++i) {
+      exec.enqueue_work([&] (void* data) {
+        int value = *static_cast<int*>(data);
+        if (value != last_seen + 1)
+          out_of_order = true;
+
+        last_seen = value;
+        ++total_executed;
+      }, int{i});
+    }
+  });
+
+  // When
+  while (total_executed < num_items)
+    exec.try_execute(16);
+
+  producer.join();
+
+  // Then
+  ASSERT_FALSE(out_of_order);
+  ASSERT_EQ(total_executed, num_items);
+}
+
+TEST(executor, does_not_allocate_once_warmed_up) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    int executed = 0;
+
+    auto enqueue_and_execute = [&] {
+      for (int i = 0; i < 200; ++i)
+        exec.enqueue_work([&] (void* data) {executed += *static_cast<int*>(data); }, int{1});
+
+      exec.execute();
+    };
+
+    // Both halves of the locking double buffer get their chunks
+    enqueue_and_execute();
+    enqueue_and_execute();
+
+    // When
+    alloc_counter allocs;
+
+    for (int i = 0; i < 10; ++i)
+      enqueue_and_execute();
+
+    // Then
+    ASSERT_EQ(executed, 2400);
+    ASSERT_EQ(allocs.total_allocation_count(), 0);
+  }
+}
+
+TEST(executor, oversized_tasks_reuse_pooled_storage) {
+  struct large_payload {
+    int values[64];
+  };
+
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    int executed = 0;
+
+    auto enqueue_and_execute = [&] {
+      for (int i = 0; i < 200; ++i)
+        exec.enqueue_work([&] (void* data) {executed += static_cast<large_payload*>(data)->values[0]; }, large_payload{{1}});
+
+      exec.execute();
+    };
+
+    enqueue_and_execute();
+    enqueue_and_execute();
+
+    // When
+    alloc_counter allocs;
+
+    for (int i = 0; i < 10; ++i)
+      enqueue_and_execute();
+
+    // Then
+    ASSERT_EQ(executed, 2400);
+    ASSERT_EQ(exec.num_oversized_tasks(), 2400u);
+    ASSERT_EQ(allocs.total_allocation_count(), 0);
+  }
+}
+
+TEST(executor, copies_data_passed_as_lvalue) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    auto data = std::make_shared<int>(123);
+
+    // When
+    exec.enqueue_work([] (void*) {}, data);
+    exec.enqueue_work([] (void*) {}, data);
+
+    // Then
+    ASSERT_TRUE(static_cast<bool>(data));
+    ASSERT_EQ(data.use_count(), 3);
+    exec.execute();
+    ASSERT_EQ(data.use_count(), 1);
+  }
+}
+
+TEST(executor, batch_keeps_order_with_single_enqueues) {
+  for (queue_type type : all_queue_types) {
+    for (std::size_t batch_size : {std::size_t{3}, std::size_t{10}}) {
+      // Given
+      executor exec(type, 4);
+      std::vector<int> executed;
+      auto record = [&] (void* data) {executed.push_back(*static_cast<int*>(data)); };
+
+      // When
+      exec.enqueue_work(record, int{0});
+
+      exec.enqueue_batch(batch_size, lane::NORMAL, [&] (std::size_t index, auto&& enqueue) {
+        enqueue(record, static_cast<int>(index) + 1);
+      });
+
+      exec.enqueue_work(record, static_cast<int>(batch_size) + 1);
+      exec.execute();
+
+      // Then
+      ASSERT_EQ(executed.size(), batch_size + 2);
+
+      for (std::size_t i = 0; i < executed.size(); ++i) {
+        ASSERT_EQ(executed[i], static_cast<int>(i));
+      }
+    }
+  }
+}
+
+TEST(executor, batch_from_several_threads_keeps_order_per_producer) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type, 16);
+    const int num_batches = 10000;
+    const int batch_size = 5;
+    int last_value[2] = {-1, -1};
+    bool out_of_order = false;
+    std::atomic_int done{0};
+    int total_executed = 0;
+
+    auto produce = [&] (int producer) {
+      for (int batch = 0; batch < num_batches; ++batch) {
+        exec.enqueue_batch(batch_size, lane::NORMAL, [&] (std::size_t index, auto&& enqueue) {
+          enqueue([&] (void* data) {
+            auto& number = *static_cast<sequence_number*>(data);
+            out_of_order |= number.value != last_value[number.producer] + 1;
+            last_value[number.producer] = number.value;
+            ++total_executed;
+          }, sequence_number{producer, batch * batch_size + static_cast<int>(index)});
+        });
+      }
+
+      ++done;
+    };
+
+    // When
+    std::thread first(produce, 0);
+    std::thread second(produce, 1);
+
+    while (done != 2)
+      exec.execute();
+
+    first.join();
+    second.join();
+    exec.execute();
+
+    // Then
+    ASSERT_FALSE(out_of_order);
+    ASSERT_EQ(total_executed, 2 * num_batches * batch_size);
+  }
+}
+
+TEST(executor, staged_tasks_are_handed_over_when_the_pass_ends) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor sender;
+    executor receiver(type);
+    sender.enable_outbound_staging();
+    std::vector<int> executed;
+    bool received_during_pass = true;
+
+    sender.enqueue_work([&] (void*) {
+      for (int i = 0; i < 10; ++i)
+        receiver.enqueue_work([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, int{i});
+
+      receiver.enqueue_batch(2, lane::NORMAL, [&] (std::size_t index, auto&& enqueue) {
+        enqueue([&] (void* data) {executed.push_back(*static_cast<int*>(data)); }, static_cast<int>(index) + 10);
+      });
+    }, 0);
+
+    sender.enqueue_work([&] (void*) {
+      receiver.execute();
+      received_during_pass = !executed.empty();
+    }, 0);
+
+    // When
+    sender.execute();
+    receiver.execute();
+
+    // Then
+    ASSERT_FALSE(received_during_pass);
+    ASSERT_EQ(executed.size(), 12u);
+
+    for (int i = 0; i < 12; ++i) {
+      ASSERT_EQ(executed[i], i);
+    }
+  }
+}
+
+TEST(executor, staged_tasks_are_handed_over_at_threshold) {
+  // Given
+  executor sender;
+  executor receiver;
+  sender.enable_outbound_staging(3);
+  int executed = 0;
+  int received_during_pass = 0;
+
+  sender.enqueue_work([&] (void*) {
+    for (int i = 0; i < 5; ++i)
+      receiver.enqueue_work([&] (void*) {++executed; }, 0);
+
+    receiver.execute();
+    received_during_pass = executed;
+  }, 0);
+
+  // When
+  sender.execute();
+  receiver.execute();
+
+  // Then
+  ASSERT_EQ(received_during_pass, 3);
+  ASSERT_EQ(executed, 5);
+}
+
+TEST(executor, staging_does_not_hold_back_work_for_own_executor) {
+  // Given
+  executor exec;
+  exec.enable_outbound_staging();
+  int executed = 0;
+
+  exec.enqueue_work([&] (void*) {
+    exec.enqueue_work([&] (void*) {++executed; }, 0);
+  }, 0);
+
+  // When
+  exec.execute();
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(executed, 1);
+}
+
+TEST(executor, stats_count_tasks_and_queue_depth) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+
+    for (int i = 0; i < 100; ++i)
+      exec.enqueue_work([] (void*) {}, 0);
+
+    executor_stats before = exec.stats();
+
+    // When
+    exec.execute();
+    exec.execute();
+    executor_stats after = exec.stats();
+
+    // Then
+    ASSERT_EQ(before.enqueued_tasks, 100u);
+    ASSERT_EQ(before.executed_tasks, 0u);
+    ASSERT_EQ(before.queue_depth, 100u);
+    ASSERT_EQ(after.executed_tasks, 100u);
+    ASSERT_EQ(after.queue_depth, 0u);
+    ASSERT_EQ(after.peak_queue_depth, 100u);
+    ASSERT_EQ(after.execute_passes, 1u);
+    ASSERT_EQ(after.pass_duration.count(), 1u);
+    ASSERT_EQ(after.enqueue_to_execute.count(), (100 + executor::latency_sample_interval - 1) / executor::latency_sample_interval);
+  }
+}
+
+TEST(executor, stats_count_lock_failures_per_executor) {
+  // Given
+  executor contended;
+  executor other;
+  std::atomic_bool locked{false};
+  std::atomic_bool release{false};
+
+  std::thread producer([&] {
+    contended.enqueue_batch(1, lane::NORMAL, [&] (std::size_t, auto&& enqueue) {
+      // Batches are produced while the queue is locked
+      locked = true;
+
+      while (!release)
+        std::this_thread::yield();
+
+      enqueue([] (void*) {}, 0);
+    });
+  });
+
+  while (!locked)
+    std::this_thread::yield();
+
+  // When
+  const bool executed = contended.try_execute();
+  release = true;
+  producer.join();
+
+  // Then
+  ASSERT_FALSE(executed);
+  ASSERT_EQ(contended.stats().lock_failures, 1u);
+  ASSERT_EQ(other.stats().lock_failures, 0u);
+}
+
+TEST(executor, bounded_executor_blocks_producer_until_there_is_room) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    exec.limit_queue(4, overflow_policy::BLOCK);
+    std::atomic_int produced{0};
+    int executed = 0;
+
+    std::thread producer([&] {
+      for (int i = 0; i < 20; ++i) {
+        exec.admit(work_kind::TASK);
+        exec.enqueue_work([&] (void*) {++executed; }, 0);
+        ++produced;
+      }
+    });
+
+    // When
+    while (exec.stats().blocked_enqueues == 0)
+      std::this_thread::yield();
+
+    const int produced_before_execute = produced;
+
+    while (executed < 20) {
+      exec.wait_for_work(std::chrono::milliseconds(1));
+      exec.execute();
+    }
+
+    producer.join();
+
+    // Then
+    ASSERT_EQ(produced_before_execute, 4);
+    ASSERT_EQ(exec.stats().peak_queue_depth, 4u);
+  }
+}
+
+TEST(executor, bounded_executor_admits_producer_during_a_long_pass) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    exec.limit_queue(20, overflow_policy::BLOCK);
+    std::atomic<bool> admitted{false};
+    bool admitted_during_pass = false;
+
+    for (int i = 0; i < 19; ++i)
+      exec.enqueue_work([] (void*) {}, 0);
+
+    // The last task keeps the pass going until the producer gets in, or gives up
+    exec.enqueue_work([&] (void*) {
+      const auto give_up_at = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+      while (!admitted && std::chrono::steady_clock::now() < give_up_at)
+        std::this_thread::yield();
+
+      admitted_during_pass = admitted;
+    }, 0);
+
+    std::thread producer([&] {
+      exec.admit(work_kind::TASK);
+      admitted = true;
+    });
+
+    while (exec.stats().blocked_enqueues == 0)
+      std::this_thread::yield();
+
+    // When
+    exec.execute();
+    producer.join();
+
+    // Then
+    ASSERT_TRUE(admitted_during_pass);
+  }
+}
+
+TEST(executor, bounded_executor_does_not_block_its_own_tasks) {
+  // Given
+  executor exec;
+  exec.limit_queue(1, overflow_policy::BLOCK);
+  int executed = 0;
+
+  exec.enqueue_work([&] (void*) {
+    // When
+    for (int i = 0; i < 3; ++i) {
+      exec.admit(work_kind::TASK);
+      exec.enqueue_work([&] (void*) {++executed; }, 0);
+    }
+  }, 0);
+
+  exec.execute();
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(executed, 3);
+  ASSERT_EQ(exec.stats().blocked_enqueues, 0u);
+}
+
+TEST(executor, bounded_executor_drops_oldest_tasks) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    exec.limit_queue(2, overflow_policy::DROP_OLDEST);
+    std::vector<int> executed;
+    int responses = 0;
+
+    for (int i = 0; i < 5; ++i) {
+      ASSERT_TRUE(exec.admit(work_kind::REQUEST));
+      exec.enqueue_work([&, i] (void*) {executed.push_back(i); }, 0);
+    }
+
+    exec.enqueue_work([&] (void*) {++responses; }, 0, lane::RESPONSE);
+
+    // When
+    exec.execute();
+
+    // Then
+    const std::vector<int> expected = {4};
+    const bool kept_newest = executed == expected;
+    ASSERT_TRUE(kept_newest);
+    ASSERT_EQ(responses, 1);
+    ASSERT_EQ(exec.stats().dropped_tasks, 4u);
+    ASSERT_EQ(exec.stats().queue_depth, 0u);
+  }
+}
+
+TEST(executor, bounded_executor_rejects_only_the_kind_its_policy_names) {
+  // Given
+  executor failing;
+  executor dropping;
+  failing.limit_queue(1, overflow_policy::FAIL_QUERIES);
+  dropping.limit_queue(1, overflow_policy::DROP_EVENTS);
+  failing.enqueue_work([] (void*) {}, 0);
+  dropping.enqueue_work([] (void*) {}, 0);
+
+  // When/Then
+  ASSERT_FALSE(failing.admit(work_kind::REQUEST));
+  ASSERT_TRUE(failing.admit(work_kind::EVENT, 2));
+  ASSERT_TRUE(failing.admit(work_kind::RESPONSE));
+  ASSERT_FALSE(dropping.admit(work_kind::EVENT, 2));
+  ASSERT_TRUE(dropping.admit(work_kind::REQUEST));
+  ASSERT_EQ(failing.stats().rejected_queries, 1u);
+  ASSERT_EQ(dropping.stats().dropped_events, 2u);
+
+  failing.execute();
+  ASSERT_TRUE(failing.admit(work_kind::REQUEST));
+}
+
+TEST(executor, compaction_removes_canceled_tasks_and_keeps_order) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    std::vector<int> executed;
+
+    for (int i = 0; i < 10; ++i) {
+      exec.enqueue_work([&] (void* data) {
+        executed.push_back(static_cast<cancelable_number*>(data)->value);
+      }, cancelable_number{i, i % 2 == 1});
+    }
+
+    // When
+    const std::size_t removed = exec.compact();
+    executor_stats compacted = exec.stats();
+    exec.execute();
+
+    // Then
+    const bool kept_in_order = executed == std::vector<int>{0, 2, 4, 6, 8};
+    ASSERT_EQ(removed, 5u);
+    ASSERT_TRUE(kept_in_order);
+    ASSERT_EQ(compacted.compacted_tasks, 5u);
+    ASSERT_EQ(compacted.queue_depth, 5u);
+    ASSERT_EQ(exec.stats().queue_depth, 0u);
+  }
+}
+
+TEST(executor, compaction_after_budgeted_execute_keeps_order) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    std::vector<int> executed;
+    std::vector<int> expected;
+    auto record = [&] (void* data) {executed.push_back(static_cast<cancelable_number*>(data)->value); };
+
+    for (int i = 0; i < 100; ++i)
+      exec.enqueue_work(record, cancelable_number{i, i % 7 == 0});
+
+    exec.execute(5);
+
+    for (int i = 100; i < 300; ++i)
+      exec.enqueue_work(record, cancelable_number{i, i % 7 == 0});
+
+    // The budgeted pass has already run the first five, canceled or not
+    for (int i = 0; i < 300; ++i) {
+      if (i < 5 || i % 7 != 0)
+        expected.push_back(i);
+    }
+
+    // When
+    exec.compact();
+    exec.execute();
+
+    // Then
+    const bool kept_in_order = executed == expected;
+    ASSERT_TRUE(kept_in_order);
+    ASSERT_EQ(exec.stats().queue_depth, 0u);
+  }
+}
+
+TEST(executor, lock_free_compaction_keeps_order_across_the_ring_boundary) {
+  // Given
+  executor exec(queue_type::LOCK_FREE_MPSC, 8);
+  std::vector<int> executed;
+  auto record = [&] (void* data) {executed.push_back(static_cast<cancelable_number*>(data)->value); };
+
+  for (int i = 0; i < 5; ++i)
+    exec.enqueue_work(record, cancelable_number{i, false});
+
+  exec.execute();
+  executed.clear();
+
+  for (int i = 0; i < 8; ++i)
+    exec.enqueue_work(record, cancelable_number{i, i < 6});
+
+  // When
+  exec.compact();
+
+  for (int i = 8; i < 14; ++i)
+    exec.enqueue_work(record, cancelable_number{i, false});
+
+  exec.execute();
+
+  // Then
+  const bool kept_in_order = executed == std::vector<int>{6, 7, 8, 9, 10, 11, 12, 13};
+  ASSERT_TRUE(kept_in_order);
+  ASSERT_EQ(exec.stats().compacted_tasks, 6u);
+}
+
+TEST(executor, channel_compaction_works_across_blocks) {
+  // Given
+  executor exec(queue_type::SPSC_CHANNELS);
+  std::vector<int> executed;
+
+  for (int i = 0; i < 300; ++i) {
+    exec.enqueue_work([&] (void* data) {
+      executed.push_back(static_cast<cancelable_number*>(data)->value);
+    }, cancelable_number{i, i % 100 != 99});
+  }
+
+  // When
+  const std::size_t removed = exec.compact();
+  exec.execute();
+
+  // Then
+  const bool kept_in_order = executed == std::vector<int>{99, 199, 299};
+  ASSERT_EQ(removed, 297u);
+  ASSERT_TRUE(kept_in_order);
+}
+
+TEST(executor, higher_lanes_execute_first) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    std::vector<int> executed;
+
+    // When
+    exec.enqueue_work([&] (void*) {executed.push_back(3); }, 0, lane::BULK);
+    exec.enqueue_work([&] (void*) {executed.push_back(2); }, 0, lane::NORMAL);
+    exec.enqueue_work([&] (void*) {executed.push_back(0); }, 0, lane::CONTROL);
+    exec.enqueue_work([&] (void*) {executed.push_back(1); }, 0, lane::RESPONSE);
+    exec.enqueue_work([&] (void*) {executed.push_back(4); }, 0, lane::BULK);
+    exec.execute();
+
+    // Then
+    ASSERT_EQ(executed.size(), 5);
+
+    for (int i = 0; i < 5; ++i) {
+      ASSERT_EQ(executed[i], i);
+    }
+  }
+}
+
+TEST(executor, starved_lane_gets_to_run_within_budget) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    bool bulk_executed = false;
+    int passes = 0;
+
+    exec.enqueue_work([&] (void*) {bulk_executed = true; }, 0, lane::BULK);
+
+    // When
+    while (!bulk_executed && passes < 100) {
+      exec.enqueue_work([] (void*) {}, 0, lane::CONTROL);
+      exec.execute(1);
+      ++passes;
+    }
+
+    // Then
+    bool ran_in_time = passes <= executor::max_starved_passes + 1;
+    ASSERT_TRUE(bulk_executed);
+    ASSERT_TRUE(ran_in_time);
+  }
+}
+
+TEST(executor, timers_fire_from_execute) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    lifetime life;
+    int fired = 0;
+    exec.schedule_timer(std::chrono::milliseconds(20), life, [&] {++fired; });
+
+    // When
+    exec.execute();
+    ASSERT_EQ(fired, 0);
+
+    bool has_work = exec.wait_for_work(std::chrono::seconds(10));
+    exec.execute();
+
+    // Then
+    ASSERT_TRUE(has_work);
+    ASSERT_EQ(fired, 1);
+  }
+}
+
+TEST(executor, wait_for_work_without_timeout_wakes_up_for_timers) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    lifetime life;
+    int fired = 0;
+    exec.schedule_timer(std::chrono::milliseconds(20), life, [&] {++fired; });
+    auto start = std::chrono::steady_clock::now();
+
+    // Wakes the wait up in case the timer is missed
+    std::thread backstop([&] {
+      std::this_thread::sleep_for(std::chrono::seconds(2));
+      exec.enqueue_work([] (void*) {}, 0);
+    });
+
+    // When
+    bool has_work = exec.wait_for_work(std::chrono::steady_clock::duration::max());
+    bool woke_up_for_timer = std::chrono::steady_clock::now() - start < std::chrono::seconds(1);
+    backstop.join();
+    exec.execute();
+
+    // Then
+    ASSERT_TRUE(has_work);
+    ASSERT_TRUE(woke_up_for_timer);
+    ASSERT_EQ(fired, 1);
+  }
+}
+
+TEST(executor, timers_stop_when_their_lifetime_ends) {
+  // Given
+  executor exec;
+  auto life = std::make_unique<lifetime>();
+  int fired = 0;
+  exec.schedule_periodic_timer(std::chrono::milliseconds(1), *life, [&] {++fired; });
+
+  // When
+  while (fired < 3) {
+    exec.wait_for_work(std::chrono::seconds(10));
+    exec.execute();
+  }
+
+  const int fired_before_reset = fired;
+  life.reset();
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(fired, fired_before_reset);
+}
+
+TEST(executor, wait_for_work_wakes_up_when_watched_fd_is_ready) {
+  // Given
+  executor exec;
+  lifetime life;
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  char received = 0;
+
+  exec.watch_fd(fds[0], EPOLLIN, life, [&] (std::uint32_t) {
+    ASSERT_EQ(read(fds[0], &received, 1), 1);
+  });
+
+  std::thread writer([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const char byte = 'x';
+    ASSERT_EQ(write(fds[1], &byte, 1), 1);
+  });
+
+  // When
+  bool has_work = exec.wait_for_work(std::chrono::seconds(10));
+  exec.execute();
+  writer.join();
+
+  // Then
+  ASSERT_TRUE(has_work);
+  ASSERT_EQ(received, 'x');
+  ASSERT_EQ(exec.stats().executed_tasks, 0u);
+
+  exec.unwatch_fd(fds[0]);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(executor, wait_for_work_on_fds_still_wakes_up_when_work_is_enqueued) {
+  for (queue_type type : all_queue_types) {
+    // Given
+    executor exec(type);
+    lifetime life;
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    int executed = 0;
+    exec.watch_fd(fds[0], EPOLLIN, life, [] (std::uint32_t) {});
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      exec.enqueue_work([&] (void*) {++executed; }, 0);
+    });
+
+    // When
+    bool has_work = exec.wait_for_work(std::chrono::seconds(10));
+    bool woke_up_early = std::chrono::steady_clock::now() - start < std::chrono::seconds(5);
+    producer.join();
+    exec.execute();
+
+    // Then
+    ASSERT_TRUE(has_work);
+    ASSERT_TRUE(woke_up_early);
+    ASSERT_EQ(executed, 1);
+
+    exec.unwatch_fd(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+
+TEST(executor, fd_callbacks_run_from_execute_without_waiting) {
+  // Given
+  executor exec;
+  lifetime life;
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  int ready = 0;
+  exec.watch_fd(fds[1], EPOLLOUT, life, [&] (std::uint32_t events) {ready += (events & EPOLLOUT) != 0; });
+
+  // When
+  exec.execute();
+  exec.unwatch_fd(fds[1]);
+  exec.execute();
+
+  // Then
+  ASSERT_EQ(ready, 1);
+
+  close(fds[0]);
+  close(fds[1]);
+}
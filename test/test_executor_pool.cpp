@@ -0,0 +1,190 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicoros/coroutine.h>
+#include <minicomps/component.h>
+#include <minicomps/component_base.h>
+#include <minicomps/broker.h>
+#include <minicomps/messaging.h>
+#include <minicomps/executor.h>
+#include <minicomps/executor_pool.h>
+#include <minicomps/testing.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+DECLARE_QUERY(Increment, int(int)); DEFINE_QUERY(Increment);
+
+class recv_component : public component_base<recv_component> {
+public:
+  recv_component(broker& broker, executor_ptr executor)
+    : component_base("receiver", broker, executor)
+    {}
+
+  virtual void publish() override {
+    publish_async_query<Increment>([this](int value, callback_result<int>&& result) {
+      result(value + 1);
+    });
+  }
+};
+
+class send_component : public component_base<send_component> {
+public:
+  send_component(broker& broker, executor_ptr executor)
+    : component_base("sender", broker, executor)
+    , increment(lookup_async_query<Increment>())
+    {}
+
+  void send(int value) {
+    increment.call(int{value}).with_callback([this] (mc::concrete_result<int> result) {
+      if (*result.get_value() < 1000)
+        send(*result.get_value());
+      else
+        done = true;
+    });
+  }
+
+  async_query<Increment> increment;
+  std::atomic_bool done{false};
+};
+
+template<typename PredicateType>
+bool wait_until(PredicateType&& predicate) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline)
+      return false;
+
+    std::this_thread::yield();
+  }
+
+  return true;
+}
+
+}
+
+TEST(executor_pool, runs_work_enqueued_before_and_after_attaching) {
+  // Given
+  executor_pool pool(2);
+  executor_ptr exec = std::make_shared<executor>();
+  std::atomic_int executed{0};
+
+  exec->enqueue_work([&] (void*) {++executed; }, 0);
+
+  // When
+  pool.attach(exec);
+  exec->enqueue_work([&] (void*) {++executed; }, 0);
+
+  // Then
+  ASSERT_TRUE(wait_until([&] {return executed == 2; }));
+  pool.detach(exec);
+}
+
+TEST(executor_pool, never_runs_an_executor_on_two_workers_at_once) {
+  for (queue_type type : {queue_type::LOCKING, queue_type::LOCK_FREE_MPSC, queue_type::SPSC_CHANNELS}) {
+    // Given
+    const int num_executors = 64;
+    const int num_hops = 20000;
+    executor_pool pool(4);
+    std::vector<executor_ptr> executors;
+    std::vector<std::atomic_bool> running(num_executors);
+    std::atomic_int hops{0};
+    std::atomic_bool overlapped{false};
+
+    for (int i = 0; i < num_executors; ++i) {
+      executors.push_back(std::make_shared<executor>(type));
+      pool.attach(executors.back());
+    }
+
+    // When
+    std::function<void(int)> hop = [&] (int index) {
+      if (running[index].exchange(true))
+        overlapped = true;
+
+      if (++hops < num_hops) {
+        int next = (index * 7 + hops) % num_executors;
+        executors[next]->enqueue_work([&, next] (void*) {hop(next); }, 0);
+        executors[(next + 1) % num_executors]->enqueue_work([&, next] (void*) {hop((next + 1) % num_executors); }, 0);
+      }
+
+      running[index] = false;
+    };
+
+    executors[0]->enqueue_work([&] (void*) {hop(0); }, 0);
+
+    // Then
+    ASSERT_TRUE(wait_until([&] {return hops >= num_hops; }));
+
+    for (auto& exec : executors)
+      pool.detach(exec);
+
+    ASSERT_FALSE(overlapped);
+  }
+}
+
+TEST(executor_pool, detached_executor_is_not_run) {
+  // Given
+  executor_pool pool(2);
+  executor_ptr exec = std::make_shared<executor>();
+  std::atomic_int executed{0};
+  pool.attach(exec);
+
+  // When
+  pool.detach(exec);
+  exec->enqueue_work([&] (void*) {++executed; }, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  // Then
+  ASSERT_EQ(executed, 0);
+  exec->execute();
+  ASSERT_EQ(executed, 1);
+}
+
+TEST(executor_pool, components_talk_without_pump_loops) {
+  // Given
+  broker broker;
+  executor_pool pool(3);
+  component_registry registry;
+  std::vector<std::shared_ptr<send_component>> senders;
+  std::vector<executor_ptr> executors;
+
+  executors.push_back(std::make_shared<executor>());
+  auto receiver = registry.create<recv_component>(broker, executors.back());
+
+  for (int i = 0; i < 100; ++i) {
+    executors.push_back(std::make_shared<executor>());
+    senders.push_back(registry.create<send_component>(broker, executors.back()));
+  }
+
+  for (auto& exec : executors)
+    pool.attach(exec);
+
+  // When
+  for (std::size_t i = 0; i < senders.size(); ++i) {
+    // The request has to be sent from the sender's strand
+    executors[i + 1]->enqueue_work([sender = senders[i].get()] (void*) {sender->send(0); }, 0);
+  }
+
+  // Then
+  ASSERT_TRUE(wait_until([&] {
+    for (auto& sender : senders) {
+      if (!sender->done)
+        return false;
+    }
+
+    return true;
+  }));
+
+  for (auto& exec : executors)
+    pool.detach(exec);
+}
@@ -168,3 +168,56 @@ TEST(fixed_any, moving_keeps_value) {
   ASSERT_EQ(*s2.get<int>(), 12345);
 }
 
+
+TEST(fixed_any, only_adds_two_pointers_to_storage) {
+  const bool compact = sizeof(fixed_any<64>) == 64 + 2 * sizeof(void*);
+  ASSERT_TRUE(compact);
+}
+
+TEST(fixed_any, moving_destroys_value_once) {
+  // Given
+  bool destroyed = false;
+
+  {
+    fixed_any<64> s1;
+    s1.assign(destructable(&destroyed));
+
+    // When
+    fixed_any<64> s2 = std::move(s1);
+    ASSERT_EQ(destroyed, false);
+    const bool moved_from = s1.get_object_ptr() == nullptr;
+    ASSERT_TRUE(moved_from);
+  }
+
+  // Then
+  ASSERT_EQ(destroyed, true);
+}
+
+TEST(fixed_any, moving_heap_value_does_not_allocate) {
+  // Given
+  uint8_buffer_type object = {};
+  object.buf[1000] = '!';
+  fixed_any<0> s1;
+  s1.assign(std::move(object));
+
+  // When
+  alloc_counter allocs;
+  fixed_any<0> s2 = std::move(s1);
+
+  // Then
+  ASSERT_EQ(allocs.total_allocation_count(), 0);
+  ASSERT_EQ(s2.get<uint8_buffer_type>()->buf[1000], '!');
+}
+
+TEST(fixed_any, assigning_lvalue_copies_it) {
+  // Given
+  auto data = std::make_shared<int>(123);
+  fixed_any<64> aas;
+
+  // When
+  aas.assign(data);
+
+  // Then
+  ASSERT_EQ(data.use_count(), 2);
+  ASSERT_EQ(**aas.get<std::shared_ptr<int>>(), 123);
+}
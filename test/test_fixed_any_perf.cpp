@@ -0,0 +1,77 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicomps/component.h>
+#include <minicomps/executor.h>
+#include <minicomps/fixed_any.h>
+#include <minicomps/testing.h>
+
+#include <iostream>
+#include <memory>
+#include <utility>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+struct request_payload {
+  int values[16];
+};
+
+/// Moves the value back and forth between two buffers, like a double-buffered queue does
+template<typename T>
+void move_back_and_forth(T value) {
+  fixed_any<96> front, back;
+  front.assign(std::move(value));
+
+  for (int i = 0; i < 10000000; ++i) {
+    back = std::move(front);
+    front = std::move(back);
+    testing::stop_optimizations(&front);
+  }
+}
+
+}
+
+TEST(fixed_any_perf, footprint) {
+  std::cout << "sizeof(fixed_any<96>): " << sizeof(fixed_any<96>) << " bytes" << std::endl;
+  // 176 bytes with std::function members, 112 with the operations table
+}
+
+TEST(fixed_any_perf, move_trivially_copyable) {
+  measure_with_allocs([&] {
+    move_back_and_forth(request_payload{});
+  });
+  // 98 ms on my computer, 319 ms with std::function members
+}
+
+TEST(fixed_any_perf, move_non_trivial) {
+  measure_with_allocs([&] {
+    move_back_and_forth(std::make_shared<int>(123));
+  });
+  // 80 ms on my computer, 348 ms with std::function members
+}
+
+TEST(fixed_any_perf, enqueue_and_execute) {
+  // Given
+  executor exec;
+  int sum = 0;
+
+  // When
+  measure_with_allocs([&] {
+    for (int i = 0; i < 10000000; ++i) {
+      exec.enqueue_work([&] (void* data) {sum += static_cast<request_payload*>(data)->values[0]; }, request_payload{{1}});
+
+      if (i % 100 == 0)
+        exec.execute();
+    }
+
+    exec.execute();
+  });
+
+  // Then
+  ASSERT_EQ(sum, 10000000);
+  // 231-270 ms on my computer, 298-358 ms when tasks were a fixed_any and a std::function
+}
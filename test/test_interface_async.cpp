@@ -14,6 +14,7 @@
 
 #include <unordered_map>
 #include <memory>
+#include <vector>
 
 using namespace testing;
 using namespace mc;
@@ -91,6 +92,55 @@ public:
   interface<receiver_if> receiver;
 };
 
+DECLARE_INTERFACE(lane_if);
+
+class lane_if {
+public:
+  ASYNC_QUERY(print, void(int));
+  ASYNC_QUERY(urgent, void(void));
+};
+
+DEFINE_INTERFACE(lane_if);
+
+class lane_receiver_impl : public component_base<lane_receiver_impl> {
+public:
+  lane_receiver_impl(broker& broker, executor_ptr executor)
+    : component_base("lane_receiver", broker, executor)
+    {}
+
+  virtual void publish() override {
+    publish_interface(receiver_);
+    publish_async_query(receiver_.print, &lane_receiver_impl::print);
+    publish_async_query(receiver_.urgent, &lane_receiver_impl::urgent, nullptr, lane::CONTROL);
+  }
+
+  void print(mc::callback_result<void>&& result, int value) {
+    print_called_with = value;
+    result({});
+  }
+
+  void urgent(mc::callback_result<void>&& result) {
+    urgent_called_after_print = print_called_with != 0;
+    result({});
+  }
+
+  int print_called_with = 0;
+  bool urgent_called_after_print = false;
+
+private:
+  lane_if receiver_;
+};
+
+class lane_sender_impl : public component_base<lane_sender_impl> {
+public:
+  lane_sender_impl(broker& broker, executor_ptr executor)
+    : component_base("lane_sender", broker, executor)
+    , receiver(lookup_interface<lane_if>())
+  {}
+
+  interface<lane_if> receiver;
+};
+
 
 TEST(test_interface_async, same_executor_coroutine_gets_resolved_with_value) {
   // Given
@@ -228,6 +278,30 @@ TEST(test_interface_async, with_custom_executor_triggers_function_later) {
   ASSERT_TRUE(recv_comp_impl->flow_function_called);
 }
 
+TEST(test_interface_async, request_in_higher_lane_overtakes_earlier_requests) {
+  // Given
+  broker broker;
+  executor_ptr sender_exec = std::make_shared<executor>();
+  executor_ptr receiver_exec = std::make_shared<executor>();
+  component_registry registry;
+  auto receiver = registry.create<lane_receiver_impl>(broker, receiver_exec);
+  auto sender = registry.create<lane_sender_impl>(broker, sender_exec);
+  std::vector<int> responses;
+
+  // When
+  sender->receiver->print.call(123).with_callback([&] (mc::concrete_result<void>&&) {responses.push_back(1); });
+  sender->receiver->urgent.call().with_callback([&] (mc::concrete_result<void>&&) {responses.push_back(2); });
+  receiver_exec->execute();
+  sender_exec->execute();
+
+  // Then
+  ASSERT_FALSE(receiver->urgent_called_after_print);
+  ASSERT_EQ(receiver->print_called_with, 123);
+  ASSERT_EQ(responses.size(), 2);
+  ASSERT_EQ(responses[0], 2); // The urgent response is enqueued in the control lane
+  ASSERT_EQ(responses[1], 1);
+}
+
 // TODO: listeners
 
 }
@@ -0,0 +1,140 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicomps/io_poller.h>
+#include <minicomps/lifetime.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+struct local_pipe {
+  local_pipe() {
+    if (pipe(fds) != 0)
+      std::abort();
+  }
+
+  ~local_pipe() {
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  void write_byte() {
+    const char byte = 1;
+    ASSERT_EQ(write(fds[1], &byte, 1), 1);
+  }
+
+  void read_byte() {
+    char byte;
+    ASSERT_EQ(read(fds[0], &byte, 1), 1);
+  }
+
+  int read_end() const {
+    return fds[0];
+  }
+
+  int fds[2];
+};
+
+}
+
+TEST(io_poller, runs_callback_when_fd_is_readable) {
+  // Given
+  io_poller poller;
+  local_pipe channel;
+  lifetime life;
+  int ready = 0;
+
+  poller.watch(channel.read_end(), EPOLLIN, life, [&] (std::uint32_t events) {
+    ready += (events & EPOLLIN) != 0;
+    channel.read_byte();
+  });
+
+  // When/Then
+  ASSERT_EQ(poller.run_ready(), 0u);
+
+  channel.write_byte();
+  ASSERT_EQ(poller.run_ready(), 1u);
+  ASSERT_EQ(ready, 1);
+
+  // Level-triggered, but the callback drained the pipe
+  ASSERT_EQ(poller.run_ready(), 0u);
+}
+
+TEST(io_poller, wait_returns_when_woken_from_another_thread) {
+  // Given
+  io_poller poller;
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread waker([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    poller.wake();
+  });
+
+  // When
+  poller.wait(std::chrono::seconds(10));
+  bool woke_up_early = std::chrono::steady_clock::now() - start < std::chrono::seconds(5);
+  waker.join();
+
+  // Then
+  ASSERT_TRUE(woke_up_early);
+  ASSERT_FALSE(poller.has_ready());
+}
+
+TEST(io_poller, stops_calling_back_once_unwatched_or_lifetime_ends) {
+  // Given
+  io_poller poller;
+  local_pipe first, second;
+  auto life = std::make_unique<lifetime>();
+  int calls = 0;
+
+  poller.watch(first.read_end(), EPOLLIN, *life, [&] (std::uint32_t) {++calls; });
+  poller.watch(second.read_end(), EPOLLIN, *life, [&] (std::uint32_t) {++calls; });
+  first.write_byte();
+  second.write_byte();
+
+  // When
+  ASSERT_TRUE(poller.unwatch(first.read_end()));
+  life.reset();
+  poller.run_ready();
+
+  // Then
+  ASSERT_EQ(calls, 0);
+  ASSERT_EQ(poller.size(), 0u);
+}
+
+TEST(io_poller, callback_can_unwatch_its_own_and_other_fds) {
+  // Given
+  io_poller poller;
+  local_pipe first, second;
+  lifetime life;
+  int calls = 0;
+
+  auto unwatch_both = [&] (std::uint32_t) {
+    ++calls;
+    poller.unwatch(first.read_end());
+    poller.unwatch(second.read_end());
+  };
+
+  poller.watch(first.read_end(), EPOLLIN, life, unwatch_both);
+  poller.watch(second.read_end(), EPOLLIN, life, unwatch_both);
+  first.write_byte();
+  second.write_byte();
+
+  // When
+  poller.run_ready();
+
+  // Then
+  ASSERT_EQ(calls, 1);
+  ASSERT_EQ(poller.size(), 0u);
+}
@@ -113,6 +113,39 @@ TEST(sync_query, reachable_returns_false_when_receiver_is_deleted) {
   ASSERT_EQ(sender->sum.reachable(), false);
 }
 
+TEST(sync_query, cached_miss_is_dropped_when_receiver_is_published) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, exec);
+  ASSERT_EQ(sender->sum.reachable(), false); // Caches the miss
+
+  // When
+  auto receiver = registry.create<recv_component>(broker, exec);
+
+  // Then
+  ASSERT_EQ(sender->sum.reachable(), true);
+  ASSERT_EQ(sender->sum(1, 2), 3);
+}
+
+TEST(sync_query, unreachable_with_two_receivers_until_one_is_removed) {
+  // Given
+  broker broker;
+  executor_ptr exec = std::make_shared<executor>();
+  component_registry registry;
+  auto sender = registry.create<send_component>(broker, exec);
+  auto first = registry.create<recv_component>(broker, exec);
+  ASSERT_EQ(sender->sum.reachable(), true);
+
+  // When/Then
+  auto second = registry.create<recv_component>(broker, exec);
+  ASSERT_EQ(sender->sum.reachable(), false);
+
+  second->unpublish_dependencies();
+  ASSERT_EQ(sender->sum.reachable(), true);
+}
+
 TEST(sync_query, invocation_calls_fallback_when_function_is_missing) {
   // Given
   broker broker;
@@ -0,0 +1,337 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicomps/task.h>
+#include <minicomps/task_ring.h>
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+struct large_payload {
+  std::uint8_t buf[256];
+};
+
+template<std::size_t Size>
+struct cancelable_payload {
+  bool is_canceled;
+  std::uint8_t buf[Size];
+
+  bool canceled() const {
+    return is_canceled;
+  }
+};
+
+}
+
+TEST(task, runs_callback_with_its_data) {
+  // Given
+  int received = 0;
+  task item([&] (void* data) {received = *static_cast<int*>(data); }, 123);
+
+  // When
+  item.execute();
+
+  // Then
+  ASSERT_EQ(received, 123);
+}
+
+TEST(task, small_payload_does_not_allocate) {
+  alloc_counter allocs;
+
+  // Given
+  int received = 0;
+  task item([&] (void* data) {received = *static_cast<int*>(data); }, 123);
+  testing::stop_optimizations(&item);
+
+  // When
+  task moved(std::move(item));
+  moved.execute();
+
+  // Then
+  ASSERT_EQ(received, 123);
+  ASSERT_EQ(allocs.total_allocation_count(), 0);
+}
+
+TEST(task, large_payload_is_stored_on_heap) {
+  alloc_counter allocs;
+
+  // Given
+  large_payload payload{};
+  payload.buf[255] = 7;
+  int received = 0;
+  task item([&] (void* data) {received = static_cast<large_payload*>(data)->buf[255]; }, payload);
+
+  // When
+  task moved(std::move(item));
+  moved.execute();
+
+  // Then
+  ASSERT_EQ(received, 7);
+  ASSERT_EQ(allocs.total_allocation_count(), 1);
+}
+
+TEST(task, large_payload_reuses_pooled_storage) {
+  // Given
+  task_pool pool;
+  task([] (void*) {}, large_payload{}, &pool).execute();
+
+  // When
+  alloc_counter allocs;
+
+  for (int i = 0; i < 10; ++i) {
+    task item([] (void*) {}, large_payload{}, &pool);
+    task moved(std::move(item));
+    moved.execute();
+  }
+
+  // Then
+  ASSERT_EQ(allocs.total_allocation_count(), 0);
+  ASSERT_EQ(pool.num_allocations(), 11u);
+}
+
+TEST(task, destroys_data_after_running) {
+  // Given
+  auto data = std::make_shared<int>(123);
+  task item([] (void*) {}, std::shared_ptr<int>(data));
+  ASSERT_EQ(data.use_count(), 2);
+
+  // When
+  item.execute();
+
+  // Then
+  ASSERT_EQ(data.use_count(), 1);
+}
+
+TEST(task, destroys_data_that_never_ran) {
+  // Given
+  auto data = std::make_shared<int>(123);
+
+  {
+    task item([] (void*) {}, std::shared_ptr<int>(data));
+    task moved(std::move(item));
+    ASSERT_EQ(data.use_count(), 2);
+  }
+
+  // Then
+  ASSERT_EQ(data.use_count(), 1);
+}
+
+TEST(task, copies_lvalue_data) {
+  // Given
+  auto data = std::make_shared<int>(123);
+
+  // When
+  task item([] (void*) {}, data);
+
+  // Then
+  ASSERT_TRUE(static_cast<bool>(data));
+  ASSERT_EQ(data.use_count(), 2);
+}
+
+TEST(task, reports_whether_its_data_is_canceled) {
+  // Given
+  auto callback = [] (void*) {};
+  task plain(callback, 0);
+  task inline_canceled(callback, cancelable_payload<8>{true, {}});
+  task heap_live(callback, cancelable_payload<256>{false, {}});
+  task heap_canceled(callback, cancelable_payload<256>{true, {}});
+
+  // Then
+  ASSERT_FALSE(plain.canceled());
+  ASSERT_TRUE(inline_canceled.canceled());
+  ASSERT_FALSE(heap_live.canceled());
+  ASSERT_TRUE(heap_canceled.canceled());
+}
+
+TEST(task_ring, keeps_order_across_chunks) {
+  // Given
+  task_ring<int, 4> ring;
+
+  for (int i = 0; i < 10; ++i)
+    ring.emplace_back(i);
+
+  // When
+  std::vector<int> popped;
+
+  while (!ring.empty()) {
+    popped.push_back(ring.front());
+    ring.pop_front();
+  }
+
+  // Then
+  const bool in_order = popped == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  ASSERT_TRUE(in_order);
+}
+
+TEST(task_ring, splice_appends_in_order) {
+  // Given
+  task_ring<int, 4> front_ring, back_ring;
+
+  for (int i = 0; i < 5; ++i)
+    front_ring.emplace_back(i);
+
+  front_ring.pop_front();
+
+  for (int i = 5; i < 11; ++i)
+    back_ring.emplace_back(i);
+
+  // When
+  front_ring.splice(back_ring);
+  front_ring.emplace_back(11);
+
+  // Then
+  ASSERT_TRUE(back_ring.empty());
+  ASSERT_EQ(front_ring.size(), 11u);
+
+  std::vector<int> popped;
+
+  while (!front_ring.empty()) {
+    popped.push_back(front_ring.front());
+    front_ring.pop_front();
+  }
+
+  const bool in_order = popped == std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+  ASSERT_TRUE(in_order);
+}
+
+TEST(task_ring, reuses_drained_chunks) {
+  // Given
+  task_ring<int, 4> producer, consumer;
+
+  auto round = [&] {
+    for (int i = 0; i < 10; ++i)
+      producer.emplace_back(i);
+
+    consumer.splice(producer);
+    producer.take_spare_chunks(consumer);
+
+    while (!consumer.empty())
+      consumer.pop_front();
+  };
+
+  // Chunks drained in one round are handed back at the next splice
+  round();
+  round();
+
+  // When
+  alloc_counter allocs;
+
+  for (int i = 0; i < 10; ++i)
+    round();
+
+  // Then
+  ASSERT_EQ(allocs.total_allocation_count(), 0);
+}
+
+TEST(task_ring, remove_if_keeps_order_of_the_rest) {
+  // Given
+  task_ring<int, 4> ring;
+
+  for (int i = 0; i < 12; ++i)
+    ring.emplace_back(i);
+
+  ring.pop_front();
+
+  // When
+  const std::size_t removed = ring.remove_if([] (int value) {return value % 3 != 0; });
+  ring.emplace_back(12);
+
+  // Then
+  ASSERT_EQ(removed, 8u);
+  ASSERT_EQ(ring.size(), 4u);
+
+  std::vector<int> popped;
+
+  while (!ring.empty()) {
+    popped.push_back(ring.front());
+    ring.pop_front();
+  }
+
+  const bool in_order = popped == std::vector<int>{3, 6, 9, 12};
+  ASSERT_TRUE(in_order);
+}
+
+TEST(task_ring, remove_if_can_empty_the_ring) {
+  // Given
+  auto data = std::make_shared<int>(123);
+  task_ring<std::shared_ptr<int>, 4> ring;
+
+  for (int i = 0; i < 10; ++i)
+    ring.emplace_back(data);
+
+  // When
+  ring.remove_if([] (const std::shared_ptr<int>&) {return true; });
+  ring.emplace_back(data);
+
+  // Then
+  ASSERT_EQ(data.use_count(), 2);
+  ASSERT_EQ(ring.size(), 1u);
+}
+
+TEST(task_ring, remove_if_works_on_partly_filled_chunks_from_splicing) {
+  // Given
+  task_ring<int, 4> ring;
+  std::vector<int> expected;
+  int next_value = 0;
+
+  // Every spliced ring leaves a chunk with a popped front and free slots in the middle
+  for (int round = 0; round < 5; ++round) {
+    task_ring<int, 4> other;
+
+    for (int i = 0; i < 6; ++i)
+      other.emplace_back(next_value++);
+
+    other.pop_front();
+    ring.splice(other);
+
+    for (int value = next_value - 5; value < next_value; ++value) {
+      if (value % 3 == 0)
+        expected.push_back(value);
+    }
+  }
+
+  // When
+  const std::size_t removed = ring.remove_if([] (int value) {return value % 3 != 0; });
+  ring.emplace_back(next_value);
+  expected.push_back(next_value);
+
+  // Then
+  ASSERT_EQ(removed, 25u - (expected.size() - 1));
+  ASSERT_EQ(ring.size(), expected.size());
+
+  std::vector<int> popped;
+
+  while (!ring.empty()) {
+    popped.push_back(ring.front());
+    ring.pop_front();
+  }
+
+  const bool in_order = popped == expected;
+  ASSERT_TRUE(in_order);
+}
+
+TEST(task_ring, destroys_remaining_items) {
+  // Given
+  auto data = std::make_shared<int>(123);
+
+  {
+    task_ring<std::shared_ptr<int>, 4> ring;
+
+    for (int i = 0; i < 10; ++i)
+      ring.emplace_back(data);
+
+    ring.pop_front();
+    ASSERT_EQ(data.use_count(), 10);
+  }
+
+  // Then
+  ASSERT_EQ(data.use_count(), 1);
+}
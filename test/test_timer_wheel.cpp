@@ -0,0 +1,173 @@
+/// Copyright 2022 Peter Backman
+
+#include "testing.h"
+
+#include <minicomps/timer_wheel.h>
+#include <minicomps/lifetime.h>
+
+#include <chrono>
+#include <vector>
+
+using namespace testing;
+using namespace mc;
+
+namespace {
+
+using namespace std::chrono_literals;
+
+const timer_wheel::clock::time_point start;
+
+}
+
+TEST(timer_wheel, fires_timer_once_its_delay_has_passed) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+  int fired = 0;
+  timers.schedule(start, 10ms, 0ms, life, [&] {++fired; });
+
+  // When/Then
+  ASSERT_EQ(timers.advance(start + 9ms), 0);
+  ASSERT_EQ(fired, 0);
+  ASSERT_EQ(timers.advance(start + 10ms), 1);
+  ASSERT_EQ(fired, 1);
+  ASSERT_EQ(timers.advance(start + 100ms), 0);
+  ASSERT_EQ(timers.size(), 0);
+}
+
+TEST(timer_wheel, fires_timers_in_deadline_order_across_levels) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+  std::vector<int> fired;
+  const int delays[] = {70000, 5, 300, 64, 4096, 63, 1000000};
+
+  for (int delay : delays) {
+    timers.schedule(start, std::chrono::milliseconds(delay), 0ms, life, [&fired, delay] {fired.push_back(delay); });
+  }
+
+  // When
+  for (int step = 1; step <= 1000; ++step)
+    timers.advance(start + std::chrono::milliseconds(step * 1000));
+
+  // Then
+  const std::vector<int> expected = {5, 63, 64, 300, 4096, 70000, 1000000};
+  bool fired_in_order = fired == expected;
+  ASSERT_TRUE(fired_in_order);
+}
+
+TEST(timer_wheel, never_fires_early_after_long_jumps) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+  auto now = start;
+  bool fired_early = false;
+
+  for (int delay = 1; delay < 300000; delay = delay * 3 + 1) {
+    const auto deadline = start + std::chrono::milliseconds(delay);
+    timers.schedule(start, std::chrono::milliseconds(delay), 0ms, life, [&, deadline] {fired_early |= now < deadline; });
+  }
+
+  // When
+  for (int i = 0; i < 200; ++i) {
+    now += std::chrono::milliseconds(i * 37);
+    timers.advance(now);
+  }
+
+  // Then
+  ASSERT_FALSE(fired_early);
+  ASSERT_EQ(timers.size(), 0);
+}
+
+TEST(timer_wheel, canceled_timer_does_not_fire) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+  int fired = 0;
+  timer_handle handle = timers.schedule(start, 10ms, 0ms, life, [&] {++fired; });
+
+  // When
+  bool canceled = timers.cancel(handle);
+  timers.advance(start + 20ms);
+
+  // Then
+  ASSERT_TRUE(canceled);
+  ASSERT_EQ(fired, 0);
+  ASSERT_FALSE(timers.cancel(handle));
+  ASSERT_EQ(timers.size(), 0);
+}
+
+TEST(timer_wheel, stale_handle_does_not_cancel_reused_node) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+  int fired = 0;
+  timer_handle first = timers.schedule(start, 1ms, 0ms, life, [] {});
+  timers.advance(start + 1ms);
+  timers.schedule(start + 1ms, 1ms, 0ms, life, [&] {++fired; });
+
+  // When
+  bool canceled = timers.cancel(first);
+  timers.advance(start + 2ms);
+
+  // Then
+  ASSERT_FALSE(canceled);
+  ASSERT_EQ(fired, 1);
+}
+
+TEST(timer_wheel, timer_does_not_fire_after_its_lifetime_ends) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+  int fired = 0;
+  timers.schedule(start, 10ms, 0ms, life, [&] {++fired; });
+  timers.schedule(start, 100000ms, 0ms, life, [&] {++fired; });
+
+  // When
+  life.reset();
+  timers.advance(start + 200000ms);
+
+  // Then
+  ASSERT_EQ(fired, 0);
+  ASSERT_EQ(timers.size(), 0);
+}
+
+TEST(timer_wheel, periodic_timer_fires_until_canceled_from_its_callback) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+  int fired = 0;
+  timer_handle handle;
+
+  handle = timers.schedule(start, 10ms, 10ms, life, [&] {
+    if (++fired == 3)
+      timers.cancel(handle);
+  });
+
+  // When
+  for (int step = 1; step <= 100; ++step)
+    timers.advance(start + std::chrono::milliseconds(step));
+
+  // Then
+  ASSERT_EQ(fired, 3);
+  ASSERT_EQ(timers.size(), 0);
+}
+
+TEST(timer_wheel, next_deadline_is_never_after_the_first_timer) {
+  // Given
+  timer_wheel timers(1ms, start);
+  lifetime life;
+
+  // When/Then
+  bool no_deadline = timers.next_deadline() == timer_wheel::clock::time_point::max();
+  ASSERT_TRUE(no_deadline);
+
+  timers.schedule(start, 10ms, 0ms, life, [] {});
+  bool at_first_timer = timers.next_deadline() == start + 10ms;
+  ASSERT_TRUE(at_first_timer);
+
+  timers.schedule(start, 5000ms, 0ms, life, [] {});
+  timers.advance(start + 10ms);
+  bool before_second_timer = timers.next_deadline() <= start + 5000ms;
+  ASSERT_TRUE(before_second_timer);
+}
@@ -1,6 +1,8 @@
 /// Copyright 2021 Peter Backman
 
+#include <cstdlib>
 #include <mutex>
+#include <new>
 
 #include "testing.h"
 
@@ -35,6 +37,23 @@ void operator delete(void* ptr) {
   free(ptr);
 }
 
+void* operator new(size_t size, std::align_val_t alignment) {
+  const size_t align = static_cast<size_t>(alignment);
+  void* ptr = aligned_alloc(align, (size + align - 1) / align * align);
+
+  if (alloc_reporting_enabled)
+    testing::alloc_system::instance().add_allocation(ptr, size);
+
+  return ptr;
+}
+
+void operator delete(void* ptr, std::align_val_t) {
+  if (alloc_reporting_enabled)
+    testing::alloc_system::instance().remove_allocation(ptr);
+
+  free(ptr);
+}
+
 #endif
 
 namespace testing {